@@ -1,5 +1,8 @@
 #pragma once
 
+#include "boundspolicy.hpp"
+#include "copyengine.hpp"
+
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
@@ -9,11 +12,11 @@
 namespace Torpedo
 {
 
-class BinaryWriter
+template<BoundsPolicy Policy = CheckedPolicy> class BinaryWriter
 {
 public:
-    constexpr BinaryWriter(void* buffer, std::size_t size) noexcept
-        : _buffer{static_cast<std::uint8_t*>(buffer)}, _size{size}
+    constexpr BinaryWriter(void* buffer, std::size_t size, MemoryState state = MemoryState::Unknown) noexcept
+        : _buffer{static_cast<std::uint8_t*>(buffer)}, _size{size}, _engine{state}
     {
     }
 
@@ -26,9 +29,10 @@ public:
             return operator<<(*data);
         }
 
-        if (CanWrite(sizeof(data)))
+        if (Verify(CanWrite(sizeof(data))))
         {
-            ProceedBuffer({reinterpret_cast<const std::uint8_t*>(&data), sizeof(data)});
+            std::memcpy(&_buffer[_pos], &data, sizeof(data));
+            _pos += sizeof(data);
         }
 
         return *this;
@@ -36,7 +40,7 @@ public:
 
     template<typename T> auto& operator<<(std::span<T> data)
     {
-        if (CanWrite(data.size_bytes()))
+        if (Verify(CanWrite(data.size_bytes())))
         {
             ProceedBuffer(data);
         }
@@ -46,7 +50,7 @@ public:
 
     template<typename T> auto& Write(std::span<T> data)
     {
-        if (not CanWrite(data.size_bytes()))
+        if (not Verify(CanWrite(data.size_bytes())))
         {
             return *this;
         }
@@ -55,9 +59,26 @@ public:
         return *this;
     }
 
+    auto& Gather(std::span<const CopyRange> ranges)
+    {
+        std::size_t end{};
+        for (const auto& range : ranges)
+        {
+            end = range.offset + range.data.size_bytes() + range.zeroFill;
+            if (not Verify(end <= _size))
+            {
+                return *this;
+            }
+        }
+
+        _engine.Gather(_buffer, ranges);
+        _pos = end;
+        return *this;
+    }
+
     void Seek(std::size_t offset)
     {
-        if (offset < _size)
+        if (Verify(offset < _size))
         {
             _pos = offset;
         }
@@ -65,7 +86,7 @@ public:
 
     void Skip(std::size_t offset)
     {
-        if (CanWrite(offset))
+        if (Verify(CanWrite(offset)))
         {
             _pos += offset;
         }
@@ -73,17 +94,31 @@ public:
 
     [[nodiscard]] constexpr std::span<std::uint8_t> Buffer() const noexcept { return {_buffer, _size}; }
     [[nodiscard]] constexpr void* Current() const noexcept { return _buffer + _pos; }
+    [[nodiscard]] constexpr bool Overflowed() const noexcept { return _overflowed; }
 
 private:
     std::uint8_t* _buffer{};
     std::size_t _size{};
     std::size_t _pos{};
+    CopyEngine _engine;
+    bool _overflowed{false};
 
     [[nodiscard]] constexpr bool CanWrite(std::size_t size) const noexcept { return _pos + size <= _size; }
 
+    constexpr bool Verify(bool inBounds) noexcept
+    {
+        if (Policy::Verify(inBounds))
+        {
+            return true;
+        }
+
+        _overflowed = true;
+        return false;
+    }
+
     void ProceedBuffer(std::span<const std::uint8_t> data)
     {
-        std::memcpy(&_buffer[_pos], data.data(), data.size_bytes());
+        _engine.Copy(&_buffer[_pos], data);
         _pos += data.size_bytes();
     }
 };
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cassert>
+#include <concepts>
+
+namespace Torpedo
+{
+
+// Checks every access and lets the caller find out afterwards that something did not fit.
+struct CheckedPolicy
+{
+    static constexpr bool Verify(bool inBounds) noexcept { return inBounds; }
+};
+
+// For layouts that were validated up front. The check only survives as an assert, so release builds emit raw stores.
+struct UncheckedPolicy
+{
+    static constexpr bool Verify([[maybe_unused]] bool inBounds) noexcept
+    {
+        assert(inBounds);
+        return true;
+    }
+};
+
+template<typename T>
+concept BoundsPolicy = requires(bool inBounds) {
+    { T::Verify(inBounds) } -> std::same_as<bool>;
+};
+
+} // namespace Torpedo
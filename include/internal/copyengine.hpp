@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <emmintrin.h>
+#include <span>
+
+namespace Torpedo
+{
+
+enum class MemoryState
+{
+    Unknown,
+    Zeroed,
+};
+
+struct CopyRange
+{
+    std::size_t offset{};
+    std::span<const std::uint8_t> data{};
+    std::size_t zeroFill{};
+};
+
+namespace detail
+{
+
+constexpr std::size_t streamAlignment = 16;
+
+constexpr std::size_t alignmentHead(const void* p, std::size_t size) noexcept
+{
+    const auto misalignment = reinterpret_cast<std::uintptr_t>(p) % streamAlignment;
+    return std::min(size, misalignment ? streamAlignment - misalignment : 0);
+}
+
+inline void streamCopy(std::uint8_t* dst, const std::uint8_t* src, std::size_t size) noexcept
+{
+    const auto head = alignmentHead(dst, size);
+    std::memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, dst += 64, src += 64)
+    {
+        const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+        const auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+        const auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), a);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 48), d);
+    }
+
+    for (; size >= 16; size -= 16, dst += 16, src += 16)
+    {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+    }
+
+    std::memcpy(dst, src, size);
+}
+
+inline void streamZero(std::uint8_t* dst, std::size_t size) noexcept
+{
+    const auto head = alignmentHead(dst, size);
+    std::memset(dst, 0, head);
+    dst += head;
+    size -= head;
+
+    const auto zero = _mm_setzero_si128();
+    for (; size >= 16; size -= 16, dst += 16)
+    {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), zero);
+    }
+
+    std::memset(dst, 0, size);
+}
+
+} // namespace detail
+
+// Copies image data into freshly allocated memory. Batches large enough to evict the working set are written with
+// non-temporal stores, since a mapped image is rarely read back right after it is copied.
+class CopyEngine
+{
+public:
+    static constexpr std::size_t NonTemporalThreshold = 256 * 1024;
+
+    constexpr explicit CopyEngine(MemoryState state = MemoryState::Unknown) noexcept : _state{state} {}
+
+    void Copy(std::uint8_t* dst, std::span<const std::uint8_t> src) const noexcept
+    {
+        const CopyRange range{0, src, 0};
+        Gather(dst, {&range, 1});
+    }
+
+    void Gather(std::uint8_t* base, std::span<const CopyRange> ranges) const noexcept
+    {
+        std::size_t total{};
+        for (const auto& range : ranges)
+        {
+            total += range.data.size_bytes() + range.zeroFill;
+        }
+
+        const bool stream = total >= NonTemporalThreshold;
+        for (const auto& range : ranges)
+        {
+            auto dst = base + range.offset;
+            if (stream)
+            {
+                detail::streamCopy(dst, range.data.data(), range.data.size_bytes());
+            }
+            else
+            {
+                std::memcpy(dst, range.data.data(), range.data.size_bytes());
+            }
+
+            if (range.zeroFill == 0 || _state == MemoryState::Zeroed)
+            {
+                continue;
+            }
+
+            dst += range.data.size_bytes();
+            if (stream)
+            {
+                detail::streamZero(dst, range.zeroFill);
+            }
+            else
+            {
+                std::memset(dst, 0, range.zeroFill);
+            }
+        }
+
+        // streaming stores are weakly ordered; publish them before anyone else touches the image
+        if (stream)
+        {
+            _mm_sfence();
+        }
+    }
+
+private:
+    MemoryState _state{MemoryState::Unknown};
+};
+
+} // namespace Torpedo
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace Torpedo
+{
+
+struct ExportEntry
+{
+    std::string_view name{};
+    std::uint32_t rva{};
+    std::uint16_t ordinal{};
+};
+
+// Named exports sorted by name for binary search.
+class ExportIndex
+{
+public:
+    ExportIndex(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : _entries{resource} {}
+
+    void Add(const ExportEntry& entry) { _entries.push_back(entry); }
+    void Reserve(std::size_t size) { _entries.reserve(size); }
+
+    // The export name table is sorted by the linker, so this is normally a no-op check.
+    void Seal()
+    {
+        constexpr auto byName = [](const auto& lhs, const auto& rhs) { return lhs.name < rhs.name; };
+        if (not std::ranges::is_sorted(_entries, byName))
+        {
+            std::ranges::sort(_entries, byName);
+        }
+    }
+
+    [[nodiscard]] std::span<const ExportEntry> Entries() const noexcept { return _entries; }
+
+    [[nodiscard]] const ExportEntry* Find(std::string_view name) const noexcept
+    {
+        auto entry = std::ranges::lower_bound(_entries, name, {}, &ExportEntry::name);
+        return entry != _entries.end() && entry->name == name ? &*entry : nullptr;
+    }
+
+private:
+    std::pmr::vector<ExportEntry> _entries;
+};
+
+} // namespace Torpedo
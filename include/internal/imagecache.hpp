@@ -0,0 +1,163 @@
+#pragma once
+
+#include "pe.hpp"
+#include "validator.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace Torpedo
+{
+
+// A parse that has also passed validation, so ModuleLoader can map it without checking the layout again.
+struct CachedImage
+{
+    std::shared_ptr<const PE> pe;
+    std::optional<ValidatedPE> validated;
+    std::filesystem::file_time_type lastWriteTime;
+    std::uintmax_t fileSize;
+};
+
+struct ImageCacheStats
+{
+    std::uint64_t hits{};
+    std::uint64_t misses{};
+    std::uint64_t evictions{};
+    std::uint64_t invalidations{};
+    std::size_t entries{};
+    std::size_t bytes{};
+};
+
+// Least-recently-used cache of parsed images keyed by path, bounded by the total size of the cached file data. An
+// entry is reused only while the file's size and last write time are unchanged, so each lookup costs one stat.
+// Entries are shared_ptrs, so an eviction never invalidates an image a caller still holds. Changed files are re-read
+// through PE::Refresh, which reuses the previous image when no page changed and otherwise carries over the export
+// index if the change did not touch it.
+class ImageCache
+{
+public:
+    ImageCache(std::size_t byteBudget) : _byteBudget{byteBudget} {}
+
+    ImageCache(const ImageCache&) = delete;
+    ImageCache& operator=(const ImageCache&) = delete;
+
+    [[nodiscard]] std::shared_ptr<const CachedImage> Get(const std::filesystem::path& path)
+    {
+        std::error_code ec;
+        const auto lastWriteTime = std::filesystem::last_write_time(path, ec);
+        const auto fileSize = ec ? 0 : std::filesystem::file_size(path, ec);
+        if (ec)
+        {
+            return nullptr;
+        }
+
+        auto key = path.lexically_normal().string();
+        auto [image, stale] = Lookup(key, lastWriteTime, fileSize);
+        if (image)
+        {
+            return image;
+        }
+
+        // parse outside the lock; two racing misses on one path both parse and the later insert wins. A stale entry
+        // is refreshed rather than parsed from scratch, and keeps its validation when no page actually changed.
+        auto pe = stale ? PE::Refresh(stale->pe, path) : PE::Open(path);
+        if (not pe->Ok())
+        {
+            return nullptr;
+        }
+
+        auto validated = stale && pe == stale->pe ? stale->validated : Validate(*pe);
+        image = std::make_shared<const CachedImage>(std::move(pe), std::move(validated), lastWriteTime, fileSize);
+        Insert(std::move(key), image);
+        return image;
+    }
+
+    [[nodiscard]] ImageCacheStats Stats() const
+    {
+        std::scoped_lock lock{_mutex};
+        return {_hits, _misses, _evictions, _invalidations, _lru.size(), _bytes};
+    }
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const CachedImage>>;
+
+    mutable std::mutex _mutex;
+    std::list<Entry> _lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+    std::size_t _byteBudget;
+    std::size_t _bytes{};
+    std::uint64_t _hits{};
+    std::uint64_t _misses{};
+    std::uint64_t _evictions{};
+    std::uint64_t _invalidations{};
+
+    static std::size_t Cost(const CachedImage& image) noexcept { return image.pe->Data().size(); }
+
+    // Returns the cached image on a hit, or the outdated one it replaces when the file has changed since.
+    std::pair<std::shared_ptr<const CachedImage>, std::shared_ptr<const CachedImage>> Lookup(
+        const std::string& key, std::filesystem::file_time_type lastWriteTime, std::uintmax_t fileSize)
+    {
+        std::scoped_lock lock{_mutex};
+
+        auto found = _index.find(key);
+        if (found == _index.end())
+        {
+            ++_misses;
+            return {};
+        }
+
+        auto entry = found->second;
+        if (entry->second->lastWriteTime != lastWriteTime || entry->second->fileSize != fileSize)
+        {
+            ++_misses;
+            ++_invalidations;
+            auto stale = entry->second;
+            Erase(found);
+            return {nullptr, std::move(stale)};
+        }
+
+        ++_hits;
+        _lru.splice(_lru.begin(), _lru, entry);
+        return {entry->second, nullptr};
+    }
+
+    void Insert(std::string key, std::shared_ptr<const CachedImage> image)
+    {
+        std::scoped_lock lock{_mutex};
+
+        if (auto found = _index.find(key); found != _index.end())
+        {
+            Erase(found);
+        }
+
+        _bytes += Cost(*image);
+        _lru.emplace_front(key, std::move(image));
+        _index.emplace(std::move(key), _lru.begin());
+
+        // always keep the newest entry, even when it alone exceeds the budget
+        while (_bytes > _byteBudget && _lru.size() > 1)
+        {
+            ++_evictions;
+            Erase(_index.find(_lru.back().first));
+        }
+    }
+
+    void Erase(std::unordered_map<std::string, std::list<Entry>::iterator>::iterator found)
+    {
+        _bytes -= Cost(*found->second->second);
+        _lru.erase(found->second);
+        _index.erase(found);
+    }
+};
+
+} // namespace Torpedo
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "copyengine.hpp"
+#include "pagehash.hpp"
+#include "validator.hpp"
+
+#include <Windows.h>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <emmintrin.h>
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+namespace Torpedo
+{
+
+// Sorted RVAs of every 64-bit value in an image that depends on where it was loaded: the DIR64 relocation sites, plus
+// the ImageBase field of the optional header, which the loader rewrites to the actual base.
+class RelocationSites
+{
+public:
+    RelocationSites(const ValidatedPE& validated,
+                    std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : _sites{resource}
+    {
+        const auto& pe = validated.Image();
+        _preferredBase = pe.NtHeader()->OptionalHeader.ImageBase;
+        _sites.push_back(static_cast<std::uint32_t>(
+            reinterpret_cast<const std::uint8_t*>(&pe.NtHeader()->OptionalHeader.ImageBase) - pe.Data().data()));
+        validated.ForEachRelocation([this](std::uint32_t rva, auto) { _sites.push_back(rva); });
+
+        std::ranges::sort(_sites);
+        _sites.erase(std::ranges::unique(_sites).begin(), _sites.end());
+    }
+
+    [[nodiscard]] constexpr std::uint64_t PreferredBase() const noexcept { return _preferredBase; }
+    [[nodiscard]] std::span<const std::uint32_t> All() const noexcept { return _sites; }
+
+    // Sites whose eight bytes overlap [rva, rva + size).
+    [[nodiscard]] std::span<const std::uint32_t> Overlapping(std::uint32_t rva, std::size_t size) const noexcept
+    {
+        const auto first = std::ranges::lower_bound(_sites, rva < 8 ? 0 : rva - 7);
+        const auto last = std::lower_bound(first, _sites.end(), rva + size);
+        return {first, last};
+    }
+
+private:
+    std::pmr::vector<std::uint32_t> _sites;
+    std::uint64_t _preferredBase{};
+};
+
+namespace detail
+{
+
+// The part of `ranges`, which must be sorted and non-overlapping, that overlaps [rva, rva + size).
+inline std::span<const FileRange> overlappingRanges(std::span<const FileRange> ranges, std::size_t rva,
+                                                    std::size_t size) noexcept
+{
+    const auto first =
+        std::ranges::partition_point(ranges, [rva](const auto& range) { return range.offset + range.size <= rva; });
+    const auto last = std::find_if(first, ranges.end(), [end = rva + size](const auto& range) {
+        return range.offset >= end;
+    });
+    return {first, last};
+}
+
+// Rewrites `out`, a copy of `length` bytes from `offset` into the page at `rva`, as it reads at the preferred base:
+// every relocation site in `sites` loses `delta` and every range in `masked` becomes zero. Site values are read from
+// `page`, so a site running past either end of the copy is still normalised correctly.
+inline void normalise(std::uint8_t* out, const std::uint8_t* page, std::uint32_t rva, std::size_t offset,
+                      std::size_t length, std::span<const std::uint32_t> sites, std::uint64_t delta,
+                      std::span<const FileRange> masked) noexcept
+{
+    const auto begin = static_cast<std::int64_t>(rva + offset);
+    const auto end = begin + static_cast<std::int64_t>(length);
+    for (auto s = sites.begin(); delta != 0 && s != sites.end() && *s < end; ++s)
+    {
+        if (*s + 8 <= begin)
+        {
+            continue;
+        }
+
+        std::uint64_t value{};
+        std::memcpy(&value, page + (static_cast<std::int64_t>(*s) - rva), sizeof(value));
+        value -= delta;
+
+        const auto from = std::max<std::int64_t>(*s, begin);
+        const auto to = std::min<std::int64_t>(*s + 8, end);
+        std::memcpy(out + (from - begin), reinterpret_cast<const std::uint8_t*>(&value) + (from - *s),
+                    static_cast<std::size_t>(to - from));
+    }
+
+    for (const auto& range : masked)
+    {
+        const auto from = std::max<std::int64_t>(range.offset, begin);
+        const auto to = std::min<std::int64_t>(range.offset + range.size, end);
+        if (from < to)
+        {
+            std::memset(out + (from - begin), 0, static_cast<std::size_t>(to - from));
+        }
+    }
+}
+
+// Hash of one image page as it would look at the preferred base. `page` points at the page's first byte inside an
+// image mapped contiguously, anything past `size` is hashed as zero, `sites` are the relocation sites overlapping the
+// page, whose values are `delta` higher than at the preferred base, and `masked` ranges are hashed as zero. Stripes
+// with none of those are hashed straight from memory; only the few that have one go through a 32-byte scratch copy.
+inline std::uint64_t hashImagePage(const std::uint8_t* page, std::size_t size, std::uint32_t rva,
+                                   std::span<const std::uint32_t> sites, std::uint64_t delta,
+                                   std::span<const FileRange> masked = {}) noexcept
+{
+    constexpr std::size_t stripe = 32;
+
+    // multiply the low and high halves of each keyed lane and add the lane's swapped neighbour, as XXH3 does; the key
+    // advances every stripe so equal stripes at different offsets hash differently
+    auto acc0 = _mm_set_epi64x(static_cast<long long>(HashPrime2), static_cast<long long>(HashPrime1));
+    auto acc1 = _mm_set_epi64x(static_cast<long long>(~HashPrime2), static_cast<long long>(~HashPrime1));
+    auto key0 = _mm_set_epi64x(static_cast<long long>(HashPrime1 * 3), static_cast<long long>(HashPrime2 * 5));
+    auto key1 = _mm_set_epi64x(static_cast<long long>(HashPrime1 * 7), static_cast<long long>(HashPrime2 * 11));
+    const auto step = _mm_set1_epi64x(static_cast<long long>(HashPrime1));
+    const auto accumulate = [](__m128i acc, __m128i data, __m128i key) {
+        const auto keyed = _mm_xor_si128(data, key);
+        const auto product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+        return _mm_add_epi64(acc, _mm_add_epi64(product, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+    };
+
+    auto site = delta != 0 ? sites.begin() : sites.end();
+    auto mask = masked.begin();
+    alignas(16) std::uint8_t scratch[stripe];
+    for (std::size_t offset = 0; offset < PageHashes::PageSize; offset += stripe)
+    {
+        const auto stripeRva = rva + offset;
+        auto data = page + offset;
+        if (offset + stripe > size || (site != sites.end() && *site < stripeRva + stripe) ||
+            (mask != masked.end() && mask->offset < stripeRva + stripe))
+        {
+            std::memset(scratch, 0, stripe);
+            if (offset < size)
+            {
+                std::memcpy(scratch, page + offset, std::min(stripe, size - offset));
+            }
+
+            // a site or mask may start in an earlier stripe or run on into the next one, so neither is dropped until
+            // it ends here
+            normalise(scratch, page, rva, offset, stripe, {site, sites.end()}, delta, {mask, masked.end()});
+            while (site != sites.end() && *site + 8 <= stripeRva + stripe)
+            {
+                ++site;
+            }
+
+            while (mask != masked.end() && mask->offset + mask->size <= stripeRva + stripe)
+            {
+                ++mask;
+            }
+
+            data = scratch;
+        }
+
+        acc0 = accumulate(acc0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), key0);
+        acc1 = accumulate(acc1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)), key1);
+        key0 = _mm_add_epi64(key0, step);
+        key1 = _mm_add_epi64(key1, step);
+    }
+
+    alignas(16) std::uint64_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc0);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes + 2), acc1);
+
+    auto hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+    hash ^= hash >> 33;
+    hash *= HashPrime2;
+    hash ^= hash >> 29;
+    hash *= HashPrime1;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Where each part of the file lands in the mapped image, in the order ModuleLoader copies it.
+inline std::pmr::vector<CopyRange> mappedLayout(const PE& pe, std::pmr::polymorphic_allocator<> allocator)
+{
+    const auto data = pe.Data();
+    const auto sectionHeaders = pe.SectionHeaders();
+    const auto headerSize =
+        reinterpret_cast<const std::uint8_t*>(sectionHeaders.data() + sectionHeaders.size()) - data.data();
+
+    std::pmr::vector<CopyRange> pieces{allocator};
+    pieces.push_back({0, data.first(headerSize), 0});
+    const auto& sections = pe.Sections();
+    for (std::size_t i = 0; i < sections.Size(); ++i)
+    {
+        if (sections.RawSizes()[i] != 0)
+        {
+            const auto raw = data.subspan(sections.RawPointers()[i], sections.RawSizes()[i]);
+            pieces.push_back({sections.VirtualAddresses()[i], raw, 0});
+        }
+    }
+
+    return pieces;
+}
+
+// The mapped page at `rva`, zero past the end of the returned span. When one piece covers the start of the page, as
+// it nearly always does, that is a view of the file; otherwise the page is assembled into `buffer`.
+inline std::span<const std::uint8_t> filePage(std::span<const CopyRange> pieces, std::uint32_t rva,
+                                              std::uint8_t* buffer) noexcept
+{
+    constexpr auto pageSize = PageHashes::PageSize;
+    const auto first = std::ranges::partition_point(
+        pieces, [rva](const auto& piece) { return piece.offset + piece.data.size() <= rva; });
+    const auto last =
+        std::find_if(first, pieces.end(), [rva](const auto& piece) { return piece.offset >= rva + pageSize; });
+
+    if (last - first == 1 && first->offset <= rva)
+    {
+        const auto bytes = first->data.subspan(rva - first->offset);
+        return bytes.first(std::min(bytes.size(), pageSize));
+    }
+
+    std::memset(buffer, 0, pageSize);
+    for (auto piece = first; piece != last; ++piece)
+    {
+        const auto from = std::max<std::size_t>(piece->offset, rva);
+        const auto to = std::min<std::size_t>(piece->offset + piece->data.size(), rva + pageSize);
+        std::memcpy(buffer + (from - rva), piece->data.data() + (from - piece->offset), to - from);
+    }
+
+    return {buffer, pageSize};
+}
+
+} // namespace detail
+
+// One hash per page of an image in its mapped layout, with every relocation site hashed at its preferred-base value.
+// Hashes of the file and of a copy loaded at any base agree on every page the copy has not changed since it was
+// relocated, so memory can be checked against disk without un-relocating anything first. `masked` RVA ranges, sorted
+// and non-overlapping, are hashed as zero on both sides, e.g. to leave out the IAT.
+class ImageHashes
+{
+public:
+    static constexpr std::size_t PageSize = PageHashes::PageSize;
+
+    ImageHashes(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : _hashes{resource} {}
+
+    // Hashes the image as ModuleLoader would map it, straight from the file's headers and section data.
+    void BuildFromFile(const ValidatedPE& validated, std::span<const FileRange> masked = {})
+    {
+        const auto& pe = validated.Image();
+        const auto pieces = detail::mappedLayout(pe, _hashes.get_allocator());
+
+        _hashes.resize((pe.ImageSize() + PageSize - 1) / PageSize);
+        alignas(16) std::uint8_t buffer[PageSize];
+        for (std::size_t i = 0; i < _hashes.size(); ++i)
+        {
+            const auto rva = static_cast<std::uint32_t>(i * PageSize);
+            const auto page = detail::filePage(pieces, rva, buffer);
+            _hashes[i] = detail::hashImagePage(page.data(), page.size(), rva, {}, 0,
+                                               detail::overlappingRanges(masked, rva, PageSize));
+        }
+    }
+
+    // Hashes an image that was loaded and relocated at image.data().
+    void BuildFromImage(std::span<const std::uint8_t> image, const RelocationSites& sites,
+                        std::span<const FileRange> masked = {})
+    {
+        const auto delta = reinterpret_cast<std::uint64_t>(image.data()) - sites.PreferredBase();
+        _hashes.resize((image.size() + PageSize - 1) / PageSize);
+        for (std::size_t i = 0; i < _hashes.size(); ++i)
+        {
+            const auto rva = static_cast<std::uint32_t>(i * PageSize);
+            _hashes[i] = detail::hashImagePage(image.data() + rva, std::min(PageSize, image.size() - rva), rva,
+                                               sites.Overlapping(rva, PageSize), delta,
+                                               detail::overlappingRanges(masked, rva, PageSize));
+        }
+    }
+
+    [[nodiscard]] std::span<const std::uint64_t> Hashes() const noexcept { return _hashes; }
+
+    // RVA ranges of pages that differ from `other`, merged where adjacent.
+    [[nodiscard]] std::pmr::vector<FileRange> Diff(const ImageHashes& other) const
+    {
+        return detail::diffPages(_hashes, other._hashes, _hashes.get_allocator());
+    }
+
+private:
+    std::pmr::vector<std::uint64_t> _hashes;
+};
+
+} // namespace Torpedo
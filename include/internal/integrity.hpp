@@ -0,0 +1,292 @@
+#pragma once
+
+#include "imagehash.hpp"
+#include "loader.hpp"
+#include "validator.hpp"
+
+#include <Windows.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <emmintrin.h>
+#include <memory_resource>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace Torpedo
+{
+
+namespace detail
+{
+
+// Appends the byte ranges in [from, to) where `actual` and `expected` differ to `patched`, merging with its last range
+// where they touch. Both point at the start of the same page, which begins at `rva`.
+inline void diffBytes(const std::uint8_t* actual, const std::uint8_t* expected, std::uint32_t rva, std::size_t from,
+                      std::size_t to, std::pmr::vector<FileRange>& patched)
+{
+    const auto report = [&](std::size_t offset) {
+        if (not patched.empty() && patched.back().offset + patched.back().size == rva + offset)
+        {
+            ++patched.back().size;
+        }
+        else
+        {
+            patched.push_back({rva + offset, 1});
+        }
+    };
+
+    auto offset = from;
+    for (; offset + 16 <= to; offset += 16)
+    {
+        const auto equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(actual + offset)),
+                                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(expected + offset)));
+        for (auto differs = ~static_cast<unsigned>(_mm_movemask_epi8(equal)) & 0xffff; differs != 0;
+             differs &= differs - 1)
+        {
+            report(offset + std::countr_zero(differs));
+        }
+    }
+
+    for (; offset < to; ++offset)
+    {
+        if (actual[offset] != expected[offset])
+        {
+            report(offset);
+        }
+    }
+}
+
+} // namespace detail
+
+// Checks the code and read-only sections of a loaded image against the file it was loaded from. The file side is
+// hashed once, up front. Each Scan hashes only the checked pages of the loaded copy, and compares byte for byte only
+// the pages whose hash differs, so an untouched image costs one pass of hashing. Relocation sites are compared at
+// their preferred-base values, and the IAT, which the loader fills in, is left out, as are the pages Module::Discard
+// may decommit. The PE must outlive the scanner.
+class IntegrityScanner
+{
+public:
+    IntegrityScanner(const ValidatedPE& validated,
+                     std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : _pe{&validated.Image()}, _sites{validated, resource}, _masked{resource}, _checked{resource},
+          _pieces{detail::mappedLayout(validated.Image(), resource)}, _expected{resource},
+          _discardable{detail::discardableRanges(
+              _pe->Sections(), _pe->NtHeader()->OptionalHeader.SectionAlignment, _pe->ImageSize(),
+              validated.ImportDescriptors(), [&validated](std::uint64_t rva) {
+                  return validated.At<std::uint8_t>(static_cast<std::uint32_t>(rva));
+              },
+              resource)}
+    {
+        for (const auto& descriptor : validated.ImportDescriptors())
+        {
+            auto thunk = validated.At<std::uint64_t>(descriptor.OriginalFirstThunk ? descriptor.OriginalFirstThunk
+                                                                                   : descriptor.FirstThunk);
+            std::uint32_t count = 0;
+            while (thunk[count] != 0)
+            {
+                ++count;
+            }
+
+            _masked.push_back({descriptor.FirstThunk, count * sizeof(std::uint64_t)});
+        }
+
+        std::ranges::sort(_masked, {}, &FileRange::offset);
+        Coalesce(_masked);
+
+        const auto& sections = _pe->Sections();
+        for (std::size_t i = 0; i < sections.Size(); ++i)
+        {
+            if ((sections.Characteristics()[i] & (IMAGE_SCN_MEM_WRITE | IMAGE_SCN_MEM_DISCARDABLE)) == 0)
+            {
+                _checked.push_back({sections.VirtualAddresses()[i],
+                                    std::max(sections.VirtualSizes()[i], sections.RawSizes()[i])});
+            }
+        }
+
+        Coalesce(_checked);
+
+        ImageHashes hashes{resource};
+        hashes.BuildFromFile(validated, _masked);
+        _expected.assign(hashes.Hashes().begin(), hashes.Hashes().end());
+    }
+
+    // RVA ranges of code and read-only data in `image` that no longer match the file, merged where adjacent.
+    // `image` must be the loaded copy at the address it was relocated for.
+    [[nodiscard]] std::pmr::vector<FileRange> Scan(std::span<const std::uint8_t> image) const
+    {
+        std::pmr::vector<FileRange> patched{_checked.get_allocator()};
+        if (image.size() != _pe->ImageSize())
+        {
+            patched.push_back({0, image.size()});
+            return patched;
+        }
+
+        const auto delta = reinterpret_cast<std::uint64_t>(image.data()) - _sites.PreferredBase();
+        std::size_t lastPage = SIZE_MAX;
+        for (const auto& checked : _checked)
+        {
+            for (auto page = checked.offset / PageSize; page * PageSize < checked.offset + checked.size; ++page)
+            {
+                // neighbouring sections can share a page
+                if (page == lastPage)
+                {
+                    continue;
+                }
+
+                lastPage = page;
+                const auto rva = static_cast<std::uint32_t>(page * PageSize);
+                if (Discardable(rva))
+                {
+                    continue;
+                }
+
+                const auto size = std::min(PageSize, image.size() - rva);
+                const auto sites = _sites.Overlapping(rva, PageSize);
+                const auto masked = detail::overlappingRanges(_masked, rva, PageSize);
+                if (detail::hashImagePage(image.data() + rva, size, rva, sites, delta, masked) == _expected[page])
+                {
+                    continue;
+                }
+
+                Compare(image.data() + rva, size, rva, sites, delta, masked, patched);
+            }
+        }
+
+        return patched;
+    }
+
+    [[nodiscard]] std::pmr::vector<FileRange> Scan(const Module& mod) const { return Scan(mod.Data()); }
+
+    [[nodiscard]] std::span<const FileRange> Checked() const noexcept { return _checked; }
+
+private:
+    static constexpr std::size_t PageSize = ImageHashes::PageSize;
+
+    const PE* _pe;
+    RelocationSites _sites;
+    std::pmr::vector<FileRange> _masked;
+    std::pmr::vector<FileRange> _checked;
+    std::pmr::vector<CopyRange> _pieces;
+    std::pmr::vector<std::uint64_t> _expected;
+    std::pmr::vector<FileRange> _discardable;
+
+    // whether the page at `rva` lies entirely in a range Module::Discard frees, so it may be decommitted
+    [[nodiscard]] bool Discardable(std::uint32_t rva) const noexcept
+    {
+        return std::ranges::any_of(detail::overlappingRanges(_discardable, rva, PageSize), [rva](const auto& range) {
+            return range.offset <= rva && range.offset + range.size >= rva + PageSize;
+        });
+    }
+
+    static void Coalesce(std::pmr::vector<FileRange>& ranges)
+    {
+        std::size_t kept = 0;
+        for (const auto& range : ranges)
+        {
+            if (kept != 0 && ranges[kept - 1].offset + ranges[kept - 1].size >= range.offset)
+            {
+                ranges[kept - 1].size =
+                    std::max(ranges[kept - 1].size, range.offset + range.size - ranges[kept - 1].offset);
+            }
+            else
+            {
+                ranges[kept++] = range;
+            }
+        }
+
+        ranges.resize(kept);
+    }
+
+    // Normalises both sides of a page whose hash differs and reports the bytes that differ within checked sections.
+    void Compare(const std::uint8_t* page, std::size_t size, std::uint32_t rva, std::span<const std::uint32_t> sites,
+                 std::uint64_t delta, std::span<const FileRange> masked, std::pmr::vector<FileRange>& patched) const
+    {
+        alignas(16) std::uint8_t actual[PageSize]{};
+        alignas(16) std::uint8_t expected[PageSize]{};
+        alignas(16) std::uint8_t buffer[PageSize];
+
+        std::memcpy(actual, page, size);
+        detail::normalise(actual, page, rva, 0, PageSize, sites, delta, masked);
+
+        const auto file = detail::filePage(_pieces, rva, buffer);
+        std::memcpy(expected, file.data(), file.size());
+        detail::normalise(expected, expected, rva, 0, PageSize, {}, 0, masked);
+
+        for (const auto& checked : detail::overlappingRanges(_checked, rva, PageSize))
+        {
+            const auto from = std::max<std::size_t>(checked.offset, rva) - rva;
+            const auto to = std::min<std::size_t>(checked.offset + checked.size, rva + size) - rva;
+            if (from < to)
+            {
+                detail::diffBytes(actual, expected, rva, from, to, patched);
+            }
+        }
+    }
+};
+
+// Runs an IntegrityScanner over one loaded image every `period` on the thread pool and passes any patched ranges to
+// `onPatched`. A tick that comes due while the previous scan is still running is skipped. The scanner and the image
+// must outlive the monitor.
+template<typename F> class IntegrityMonitor
+{
+public:
+    IntegrityMonitor(const IntegrityScanner& scanner, std::span<const std::uint8_t> image,
+                     std::chrono::milliseconds period, F onPatched)
+        : _scanner{scanner}, _image{image}, _onPatched{std::move(onPatched)}
+    {
+        _timer = CreateThreadpoolTimer(&IntegrityMonitor::Tick, this, nullptr);
+        if (_timer != nullptr)
+        {
+            // a negative due time is relative, in 100 ns units
+            const auto ticks = std::chrono::duration_cast<std::chrono::nanoseconds>(period).count() / 100;
+            const auto due = static_cast<std::uint64_t>(-ticks);
+            FILETIME dueTime{static_cast<DWORD>(due), static_cast<DWORD>(due >> 32)};
+            SetThreadpoolTimer(_timer, &dueTime, static_cast<DWORD>(period.count()), 0);
+        }
+    }
+
+    IntegrityMonitor(const IntegrityMonitor&) = delete;
+    IntegrityMonitor& operator=(const IntegrityMonitor&) = delete;
+
+    ~IntegrityMonitor()
+    {
+        if (_timer != nullptr)
+        {
+            SetThreadpoolTimer(_timer, nullptr, 0, 0);
+            WaitForThreadpoolTimerCallbacks(_timer, TRUE);
+            CloseThreadpoolTimer(_timer);
+        }
+    }
+
+    [[nodiscard]] bool Ok() const noexcept { return _timer != nullptr; }
+
+private:
+    const IntegrityScanner& _scanner;
+    std::span<const std::uint8_t> _image;
+    F _onPatched;
+    PTP_TIMER _timer{};
+    std::atomic_flag _scanning;
+
+    static void CALLBACK Tick(PTP_CALLBACK_INSTANCE, PVOID context, PTP_TIMER)
+    {
+        auto self = static_cast<IntegrityMonitor*>(context);
+        if (self->_scanning.test_and_set(std::memory_order_acquire))
+        {
+            return;
+        }
+
+        if (auto patched = self->_scanner.Scan(self->_image); not patched.empty())
+        {
+            self->_onPatched(std::span<const FileRange>{patched});
+        }
+
+        self->_scanning.clear(std::memory_order_release);
+    }
+};
+
+} // namespace Torpedo
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <memory_resource>
+
+namespace Torpedo
+{
+
+namespace detail
+{
+
+// A value that is built on first use and never changes afterwards. The read path is a single acquire load; threads
+// that race on the first call each build a candidate and the loser of the compare-exchange throws its copy away. Those
+// threads allocate from `resource` at the same time, so it must be thread-safe wherever the value is shared.
+template<typename T> class Lazy
+{
+public:
+    explicit Lazy(std::pmr::memory_resource* resource) noexcept : _allocator{resource} {}
+    Lazy(const Lazy&) = delete;
+    ~Lazy()
+    {
+        if (auto value = _value.load(std::memory_order_relaxed))
+        {
+            _allocator.delete_object(const_cast<T*>(value));
+        }
+    }
+
+    template<typename F> const T& Get(F&& build) const
+    {
+        if (auto value = _value.load(std::memory_order_acquire))
+        {
+            return *value;
+        }
+
+        const T* candidate = _allocator.template new_object<T>(build());
+        const T* expected = nullptr;
+        if (_value.compare_exchange_strong(expected, candidate, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            return *candidate;
+        }
+
+        _allocator.delete_object(const_cast<T*>(candidate));
+        return *expected;
+    }
+
+    [[nodiscard]] const T* Peek() const noexcept { return _value.load(std::memory_order_acquire); }
+
+private:
+    mutable std::pmr::polymorphic_allocator<T> _allocator;
+    mutable std::atomic<const T*> _value{};
+};
+
+} // namespace detail
+
+} // namespace Torpedo
@@ -1,31 +1,179 @@
 #pragma once
 
 #include "binarywriter.hpp"
+#include "loadplan.hpp"
 #include "pe.hpp"
 #include "peerror.hpp"
+#include "prelink.hpp"
+#include "registry.hpp"
+#include "sectiontable.hpp"
+#include "task.hpp"
+#include "trace.hpp"
+#include "validator.hpp"
 
 #include <Windows.h>
+#include <Psapi.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <memory_resource>
 #include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <winternl.h>
 
 namespace Torpedo
 {
 
+namespace detail
+{
+
+constexpr std::size_t pageSize = 0x1000;
+
+// The ranges Module::Discard frees the whole pages of: each discardable section up to its SectionAlignment boundary,
+// and each import name table with the hint/name entries it points to. `at` maps an RVA to the image's bytes, so the
+// same ranges come out of a loaded module and of the file it was loaded from. Sorted, and merged where they touch.
+template<typename At>
+std::pmr::vector<FileRange> discardableRanges(const SectionTable& sections, std::uint32_t sectionAlignment,
+                                              std::size_t imageSize,
+                                              std::span<const IMAGE_IMPORT_DESCRIPTOR> descriptors, At at,
+                                              std::pmr::memory_resource* resource)
+{
+    std::pmr::vector<FileRange> ranges{resource};
+    const std::size_t alignment = std::max<std::uint32_t>(sectionAlignment, 1);
+    for (std::size_t i = 0; i < sections.Size(); ++i)
+    {
+        if ((sections.Characteristics()[i] & IMAGE_SCN_MEM_DISCARDABLE) != 0)
+        {
+            // the rest of the section's last page, up to the next section, belongs to it
+            const std::size_t begin = sections.VirtualAddresses()[i];
+            const auto end = (begin + sections.VirtualSizes()[i] + alignment - 1) / alignment * alignment;
+            ranges.push_back({begin, std::min(end, imageSize) - std::min(begin, imageSize)});
+        }
+    }
+
+    for (const auto& descriptor : descriptors)
+    {
+        // without a separate name table the names were overwritten in the IAT itself
+        if (descriptor.OriginalFirstThunk == 0)
+        {
+            continue;
+        }
+
+        const auto thunk = reinterpret_cast<const std::uint64_t*>(at(descriptor.OriginalFirstThunk));
+        std::size_t count = 0;
+        for (; thunk[count] != 0; ++count)
+        {
+            if (not IMAGE_SNAP_BY_ORDINAL(thunk[count]))
+            {
+                const auto name = reinterpret_cast<const IMAGE_IMPORT_BY_NAME*>(at(thunk[count]))->Name;
+                ranges.push_back({static_cast<std::size_t>(thunk[count]), sizeof(WORD) + std::strlen(name) + 1});
+            }
+        }
+
+        ranges.push_back({descriptor.OriginalFirstThunk, (count + 1) * sizeof(std::uint64_t)});
+    }
+
+    // merge touching ranges, so a table spread over several pages can free the pages in its middle
+    std::ranges::sort(ranges, {}, &FileRange::offset);
+    std::size_t kept = 0;
+    for (const auto& range : ranges)
+    {
+        if (kept != 0 && ranges[kept - 1].offset + ranges[kept - 1].size >= range.offset)
+        {
+            ranges[kept - 1].size =
+                std::max(ranges[kept - 1].size, range.offset + range.size - ranges[kept - 1].offset);
+        }
+        else
+        {
+            ranges[kept++] = range;
+        }
+    }
+
+    ranges.resize(kept);
+    return ranges;
+}
+
+} // namespace detail
+
+// How a module's memory was obtained, which decides how it is released.
+enum class ModuleMemory
+{
+    // VirtualAlloc
+    Allocated,
+    // a copy-on-write view of a file, e.g. a prelinked image
+    Mapped,
+};
+
+// What prefaulting did while a module was loaded.
+struct PrefaultStats
+{
+    // pages selected for prefaulting
+    std::size_t pages{};
+    // selected pages that were not resident yet, i.e. the first-touch faults taken during the load instead of later
+    std::size_t faultsAvoided{};
+    // bytes locked into the working set
+    std::size_t lockedBytes{};
+};
+
+// What Module::Discard gave back.
+struct DiscardStats
+{
+    std::size_t decommittedBytes{};
+    // the part of decommittedBytes that was in the working set
+    std::size_t residentBytes{};
+};
+
 class Module
 {
 public:
-    Module(PVOID base, std::size_t imageSize) noexcept : _base{base}, _imageSize{imageSize} { Parse(); }
+    Module(PVOID base, std::size_t imageSize,
+           std::pmr::memory_resource* resource = std::pmr::get_default_resource(),
+           ModuleMemory memory = ModuleMemory::Allocated) noexcept
+        : _base{base}, _imageSize{imageSize}, _memory{memory}, _sections{resource}, _importModules{resource}
+    {
+        Parse();
+    }
+
+    // A module owns its mapping, so it can be moved but not copied. The registry entry follows the object.
+    Module(Module&& other) noexcept
+        : _base{std::exchange(other._base, nullptr)}, _imageSize{other._imageSize}, _memory{other._memory},
+          _dosHeader{other._dosHeader},
+          _ntHeader{other._ntHeader}, _sectionHeaders{other._sectionHeaders}, _sections{std::move(other._sections)},
+          _importModules{std::move(other._importModules)}, _prefaulted{other._prefaulted},
+          _discarded{other._discarded}, _error{other._error}, _ok{std::exchange(other._ok, false)},
+          _registered{std::exchange(other._registered, false)}
+    {
+        if (_registered)
+        {
+            ModuleRegistry::Instance().Rebind(reinterpret_cast<std::uintptr_t>(_base), this);
+        }
+    }
+    Module(const Module&) = delete;
+    Module& operator=(const Module&) = delete;
+
     ~Module() noexcept
     {
+        if (_registered)
+        {
+            ModuleRegistry::Instance().Unregister(reinterpret_cast<std::uintptr_t>(_base));
+        }
+
         for (auto module : _importModules)
         {
             FreeLibrary(module);
         }
 
-        if (_base)
+        if (_base && _memory == ModuleMemory::Mapped)
+        {
+            UnmapViewOfFile(_base);
+        }
+        else if (_base)
         {
-            VirtualFree(_base, _imageSize, MEM_FREE);
+            VirtualFree(_base, 0, MEM_RELEASE);
         }
     }
 
@@ -33,8 +181,14 @@ public:
 
     [[nodiscard]] constexpr const auto DosHeader() const noexcept { return _dosHeader; }
     [[nodiscard]] constexpr const auto NtHeader() const noexcept { return _ntHeader; }
-    [[nodiscard]] constexpr const auto& SectionHeaders() const noexcept { return _sectionHeaders; }
+    [[nodiscard]] constexpr std::span<const IMAGE_SECTION_HEADER> SectionHeaders() const noexcept
+    {
+        return _sectionHeaders;
+    }
+    [[nodiscard]] constexpr const SectionTable& Sections() const noexcept { return _sections; }
     [[nodiscard]] constexpr auto ImageBase() const noexcept { return _base; }
+    [[nodiscard]] constexpr std::size_t ImageSize() const noexcept { return _imageSize; }
+    [[nodiscard]] constexpr ModuleMemory Memory() const noexcept { return _memory; }
 
     [[nodiscard]] auto ImportDirectory() const noexcept
     {
@@ -56,22 +210,167 @@ public:
         return FetchDataDirectory<IMAGE_TLS_DIRECTORY>(IMAGE_DIRECTORY_ENTRY_TLS);
     }
 
+    [[nodiscard]] std::span<const IMAGE_RUNTIME_FUNCTION_ENTRY> RuntimeFunctions() const noexcept
+    {
+        auto runtimeFunctions = FetchDataDirectory<IMAGE_RUNTIME_FUNCTION_ENTRY>(IMAGE_DIRECTORY_ENTRY_EXCEPTION);
+        if (runtimeFunctions == nullptr)
+        {
+            return {};
+        }
+
+        const auto size = detail::dataDirectory(_ntHeader->OptionalHeader, IMAGE_DIRECTORY_ENTRY_EXCEPTION).Size;
+        return {runtimeFunctions, size / sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY)};
+    }
+
     [[nodiscard]] constexpr std::span<std::uint8_t> Data() noexcept
     {
         return {static_cast<std::uint8_t*>(_base), _imageSize};
     }
 
+    [[nodiscard]] constexpr std::span<const std::uint8_t> Data() const noexcept
+    {
+        return {static_cast<const std::uint8_t*>(_base), _imageSize};
+    }
+
     constexpr void AddImportModule(HMODULE module) { _importModules.push_back(module); }
+    [[nodiscard]] std::span<const HMODULE> ImportModules() const noexcept { return _importModules; }
+
+    constexpr void SetPrefaulted(const PrefaultStats& stats) noexcept { _prefaulted = stats; }
+
+    // Makes the module visible to ModuleRegistry readers. The loader calls this once the image is fully set up, so a
+    // symbolizer or stack walker never sees one that is still being relocated or protected, or that fails to load.
+    void Register()
+    {
+        if (_ok && not _registered)
+        {
+            ModuleRegistry::Instance().Register({reinterpret_cast<std::uintptr_t>(_base), _imageSize, this});
+            _registered = true;
+        }
+    }
+    [[nodiscard]] constexpr const PrefaultStats& Prefaulted() const noexcept { return _prefaulted; }
+
+    // Address of the named export, found by binary search over the name table the linker sorted. Returns nullptr when
+    // there is no such export or it is forwarded to another module.
+    [[nodiscard]] void* Export(std::string_view name) const noexcept
+    {
+        const auto directory = ExportDirectory();
+        if (directory == nullptr)
+        {
+            return nullptr;
+        }
+
+        const auto base = static_cast<const std::uint8_t*>(_base);
+        const auto names = reinterpret_cast<const DWORD*>(base + directory->AddressOfNames);
+        const auto ordinals = reinterpret_cast<const WORD*>(base + directory->AddressOfNameOrdinals);
+        const auto nameAt = [base](DWORD rva) { return std::string_view{reinterpret_cast<const char*>(base + rva)}; };
+
+        const auto last = names + directory->NumberOfNames;
+        const auto found = std::partition_point(names, last, [&](DWORD rva) { return nameAt(rva) < name; });
+        if (found == last || nameAt(*found) != name)
+        {
+            return nullptr;
+        }
+
+        return ExportAt(ordinals[found - names]);
+    }
+
+    // Address of the export with `ordinal` as an import table names it, i.e. including the directory's ordinal base.
+    [[nodiscard]] void* ExportByOrdinal(WORD ordinal) const noexcept
+    {
+        const auto directory = ExportDirectory();
+        if (directory == nullptr || ordinal < directory->Base)
+        {
+            return nullptr;
+        }
+
+        return ExportAt(ordinal - directory->Base);
+    }
+
+    // Typed pointer to a function export. The image is x64 code mapped into this process, so a call through it goes
+    // straight into the module with no thunk or argument marshalling in between.
+    template<typename Fn>
+    requires std::is_function_v<Fn>
+    [[nodiscard]] Fn* Function(std::string_view name) const noexcept
+    {
+        return reinterpret_cast<Fn*>(Export(name));
+    }
+
+    // Decommits the pages nothing reads once loading is done: sections marked IMAGE_SCN_MEM_DISCARDABLE, such as
+    // .reloc, and the import name tables the IAT was resolved from. A section's range runs to its SectionAlignment
+    // boundary; only pages that lie entirely in those ranges are freed, so a name table that shares a page with live
+    // data stays. IntegrityScanner leaves the same pages out of its checks. Data directories that pointed into freed
+    // pages are cleared; import descriptors are kept, but their OriginalFirstThunk may no longer be readable. A mapped
+    // module's untouched pages are file-backed and trimmed by the OS anyway, so nothing is freed for one.
+    DiscardStats Discard()
+    {
+        if (not _ok || _discarded || _memory != ModuleMemory::Allocated)
+        {
+            return {};
+        }
+
+        TraceScope trace{"loader", "discard"};
+        _discarded = true;
+        const auto importDirectory = ImportDirectory();
+        std::size_t descriptors = 0;
+        while (importDirectory && importDirectory[descriptors].Characteristics)
+        {
+            ++descriptors;
+        }
+
+        const auto base = static_cast<std::uint8_t*>(_base);
+        const auto pages = detail::discardableRanges(
+            _sections, _ntHeader->OptionalHeader.SectionAlignment, _imageSize, {importDirectory, descriptors},
+            [base](std::uint64_t rva) { return base + rva; }, _importModules.get_allocator().resource());
+
+        DiscardStats stats{};
+        std::pmr::vector<PSAPI_WORKING_SET_EX_INFORMATION> resident{_importModules.get_allocator()};
+        for (const auto& range : pages)
+        {
+            const auto first = (range.offset + detail::pageSize - 1) / detail::pageSize * detail::pageSize;
+            const auto last = std::min(range.offset + range.size, _imageSize) / detail::pageSize * detail::pageSize;
+            if (first >= last)
+            {
+                continue;
+            }
+
+            resident.clear();
+            for (auto page = first; page < last; page += detail::pageSize)
+            {
+                resident.push_back({base + page, {}});
+            }
+
+            if (QueryWorkingSetEx(GetCurrentProcess(), resident.data(),
+                                  static_cast<DWORD>(resident.size() * sizeof(PSAPI_WORKING_SET_EX_INFORMATION))))
+            {
+                const auto valid =
+                    std::ranges::count_if(resident, [](const auto& page) { return page.VirtualAttributes.Valid != 0; });
+                stats.residentBytes += static_cast<std::size_t>(valid) * detail::pageSize;
+            }
+
+            if (VirtualFree(base + first, last - first, MEM_DECOMMIT))
+            {
+                stats.decommittedBytes += last - first;
+                ClearDirectories(first, last);
+            }
+        }
+
+        return stats;
+    }
 
 private:
     PVOID _base{};
     std::size_t _imageSize;
+    ModuleMemory _memory;
     IMAGE_DOS_HEADER* _dosHeader{};
     IMAGE_NT_HEADERS* _ntHeader{};
-    std::vector<IMAGE_SECTION_HEADER*> _sectionHeaders{};
-    std::vector<HMODULE> _importModules{};
+    std::span<IMAGE_SECTION_HEADER> _sectionHeaders{};
+    SectionTable _sections;
+    std::pmr::vector<HMODULE> _importModules;
+    PrefaultStats _prefaulted{};
+    bool _discarded{false};
     PEError _error{PEError::Success};
     bool _ok{false};
+    bool _registered{false};
 
     void Parse()
     {
@@ -96,12 +395,8 @@ private:
             return;
         }
 
-        _sectionHeaders.reserve(_ntHeader->FileHeader.NumberOfSections);
-        auto pSectionHeader = IMAGE_FIRST_SECTION(_ntHeader);
-        for (int i = 0; i < _ntHeader->FileHeader.NumberOfSections; ++i)
-        {
-            _sectionHeaders.push_back(pSectionHeader++);
-        }
+        _sectionHeaders = {IMAGE_FIRST_SECTION(_ntHeader), _ntHeader->FileHeader.NumberOfSections};
+        _sections.Build(_sectionHeaders);
 
         _ntHeader->OptionalHeader.ImageBase = reinterpret_cast<ULONGLONG>(_base);
 
@@ -110,9 +405,43 @@ private:
 
     constexpr void SetError(PEError error) noexcept { _error = error; }
 
+    // the headers stay writable after loading; Parse already rewrote ImageBase in them
+    void ClearDirectories(std::size_t first, std::size_t last) noexcept
+    {
+        for (auto& directory : _ntHeader->OptionalHeader.DataDirectory)
+        {
+            if (directory.Size != 0 && directory.VirtualAddress >= first &&
+                directory.VirtualAddress + directory.Size <= last)
+            {
+                directory = {};
+            }
+        }
+    }
+
+    void* ExportAt(std::size_t index) const noexcept
+    {
+        const auto directory = ExportDirectory();
+        if (index >= directory->NumberOfFunctions)
+        {
+            return nullptr;
+        }
+
+        const auto base = static_cast<std::uint8_t*>(_base);
+        const auto rva = reinterpret_cast<const DWORD*>(base + directory->AddressOfFunctions)[index];
+
+        // a forwarder is a string inside the export directory naming the real export in another module
+        const auto exports = detail::dataDirectory(_ntHeader->OptionalHeader, IMAGE_DIRECTORY_ENTRY_EXPORT);
+        if (rva == 0 || rva - exports.VirtualAddress < exports.Size)
+        {
+            return nullptr;
+        }
+
+        return base + rva;
+    }
+
     template<typename T> [[nodiscard]] const T* FetchDataDirectory(int index) const noexcept
     {
-        auto dataDirectory = _ntHeader->OptionalHeader.DataDirectory[index];
+        auto dataDirectory = detail::dataDirectory(_ntHeader->OptionalHeader, index);
         if (dataDirectory.Size == 0)
         {
             return nullptr;
@@ -122,82 +451,346 @@ private:
     }
 };
 
+struct LoadOptions
+{
+    // Address to map the image at. Falls back to an address of the system's choosing when it is taken.
+    PVOID base{};
+    // Directory of prelinked images. When set together with `base`, a cached image for that base is mapped directly,
+    // and a fresh load at `base` is added to the cache.
+    std::filesystem::path prelinkCache{};
+    // Sections whose pages are faulted in before Load returns, so the first calls into the module do not take them.
+    // A section is selected when its characteristics share a bit with the mask: IMAGE_SCN_MEM_EXECUTE selects code,
+    // IMAGE_SCN_MEM_READ the whole image. Zero leaves every page to its first access.
+    DWORD prefaultSections{};
+    // Also lock the prefaulted sections into the working set, so they are not trimmed under memory pressure. Locking
+    // is limited by the process's minimum working set size; sections that do not fit are only prefaulted.
+    bool lockPrefaulted{};
+};
+
 class ModuleLoader
 {
 public:
-    ModuleLoader() = default;
+    ModuleLoader(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+        : _resource{resource}
+    {
+    }
 
-    std::optional<Module> Load(const PE& pe)
+    std::optional<Module> Load(const PE& pe, const LoadOptions& options = {})
     {
-        if (not pe.Ok())
+        std::optional<ValidatedPE> validated;
+        {
+            TraceScope trace{"loader", "validate"};
+            validated = Validate(pe);
+        }
+
+        if (not validated)
         {
             return {};
         }
 
-        // alloc memory
-        auto memory = VirtualAlloc(nullptr, pe.ImageSize(), MEM_COMMIT | MEM_TOP_DOWN, PAGE_READWRITE);
-        if (memory == nullptr)
+        return Load(*validated, options);
+    }
+
+    std::optional<Module> Load(const ValidatedPE& validated, const LoadOptions& options = {})
+    {
+        TraceScope trace{"loader", "load"};
+        const auto prelink = options.base != nullptr && not options.prelinkCache.empty();
+        if (prelink)
+        {
+            if (auto mod = LoadPrelinked(validated, options))
+            {
+                return mod;
+            }
+        }
+
+        auto mod = MapImage(validated, options.base);
+        if (not mod || BuildIAT(*mod, validated) == false)
         {
             return {};
         }
 
-        // copy image headers
-        BinaryWriter bw{memory, pe.ImageSize()};
-        const auto rawData = pe.Data();
-        const auto& sectionHeaders = pe.SectionHeaders();
-        const auto size =
-            reinterpret_cast<std::size_t>(sectionHeaders[0]) - reinterpret_cast<std::size_t>(rawData.data());
+        Relocate(*mod, validated);
 
-        bw << std::span{rawData.begin(), size};
+        // a prelinked entry is only valid at the base it was relocated for
+        if (prelink && mod->ImageBase() == options.base)
+        {
+            TraceScope store{"loader", "prelink store"};
+            PrelinkCache{options.prelinkCache}.Store(validated, mod->Data(), mod->ImportModules());
+        }
 
-        for (const auto& sectionHeader : sectionHeaders)
+        if (Finalize(*mod, options) == false)
         {
-            bw << sectionHeader;
+            return {};
         }
 
-        bw.Seek(sectionHeaders[0]->VirtualAddress);
+        return mod;
+    }
 
-        std::size_t pos{};
+    // Compiles `pe` into a plan that Load can replay without parsing the file again.
+    std::optional<LoadPlan> Compile(const PE& pe)
+    {
+        auto validated = Validate(pe);
+        if (not validated)
+        {
+            return {};
+        }
 
-        for (const auto sectionHeader : sectionHeaders)
+        return CompileLoadPlan(*validated, _resource);
+    }
+
+    // Maps `file` by replaying `plan`: one batched copy, then the precomputed IAT slots, relocation sites and
+    // protection runs. Fails unless `file` has the size and page digest of the bytes the plan was compiled from.
+    std::optional<Module> Load(const LoadPlan& plan, std::span<const std::uint8_t> file,
+                               const LoadOptions& options = {})
+    {
+        TraceScope trace{"loader", "load plan"};
+        if (file.size() != plan.fileSize)
         {
-            LoadSection(bw, rawData.subspan(sectionHeader->PointerToRawData, sectionHeader->SizeOfRawData),
-                        sectionHeader);
+            return {};
         }
 
-        Module mod{memory, pe.ImageSize()};
-        if (not mod.Ok() || BuildIAT(mod) == false)
+        PageHashes pages{_resource};
+        pages.Build(file);
+        if (pages.Digest() != plan.fileDigest)
         {
             return {};
         }
 
-        auto delta = mod.NtHeader()->OptionalHeader.ImageBase - pe.NtHeader()->OptionalHeader.ImageBase;
-        if (delta != 0)
+        auto memory = Allocate(plan.imageSize, options.base);
+        if (memory == nullptr)
         {
-            RelocateBase(mod, delta);
+            return {};
         }
 
-        if (FinalizeSection(mod) == false)
+        // the plan's ranges were checked against the image and file sizes when it was compiled or deserialized
+        std::pmr::vector<CopyRange> ranges{_resource};
+        ranges.reserve(plan.copies.size());
+        for (const auto& copy : plan.copies)
+        {
+            ranges.push_back({copy.rva, file.subspan(copy.fileOffset, copy.size), 0});
+        }
+
+        BinaryWriter<UncheckedPolicy> bw{memory, plan.imageSize, MemoryState::Zeroed};
+        bw.Gather(ranges);
+
+        std::optional<Module> mod{std::in_place, memory, plan.imageSize, _resource};
+        if (not mod->Ok())
         {
             return {};
         }
 
-        RunTLSCallbacks(mod);
+        std::pmr::vector<HMODULE> libraries{_resource};
+        libraries.reserve(plan.libraries.size());
+        for (const auto& library : plan.libraries)
+        {
+            auto module = LoadLibraryA(plan.String(library.name));
+            if (module == nullptr)
+            {
+                return {};
+            }
+
+            mod->AddImportModule(module);
+            libraries.push_back(module);
+        }
+
+        auto base = mod->Data().data();
+        for (const auto& import : plan.imports)
+        {
+            const auto symbol = import.byOrdinal ? reinterpret_cast<LPCSTR>(static_cast<std::uintptr_t>(import.symbol))
+                                                 : plan.String(import.symbol);
+            const auto function = reinterpret_cast<std::uintptr_t>(GetProcAddress(libraries[import.library], symbol));
+            if (function == 0)
+            {
+                return {};
+            }
 
+            std::memcpy(base + import.iatRva, &function, sizeof(function));
+        }
+
+        if (const auto delta = reinterpret_cast<std::uint64_t>(base) - plan.preferredBase; delta != 0)
+        {
+            plan.ForEachRelocation([base, delta](std::uint32_t rva) {
+                *reinterpret_cast<std::uint64_t*>(base + rva) += delta;
+            });
+        }
+
+        for (const auto& run : plan.protections)
+        {
+            DWORD oldProtect{};
+            if (VirtualProtect(base + run.rva, run.size, run.protect, &oldProtect) == FALSE)
+            {
+                return {};
+            }
+        }
+
+        Prefault(*mod, options);
+        RunTLSCallbacks(*mod);
+        mod->Register();
         return mod;
     }
 
+    // Same as Load, but the file read, the copy, every dependency load and the finalization run on the system thread
+    // pool; the coroutine resumes on `executor` between steps. The options are taken by value so they live as long as
+    // the task. The loader must outlive the task.
+    template<Executor E>
+    Task<std::optional<Module>> LoadAsync(std::filesystem::path path, E& executor, LoadOptions options = {})
+    {
+        auto pe = co_await detail::Offload{executor, [&] { return PE::Open(path, _resource); }};
+        co_return co_await LoadAsync(std::move(pe), executor, std::move(options));
+    }
+
+    template<Executor E>
+    Task<std::optional<Module>> LoadAsync(std::shared_ptr<const PE> pe, E& executor, LoadOptions options = {})
+    {
+        const auto validated = Validate(*pe);
+        if (not validated)
+        {
+            co_return std::nullopt;
+        }
+
+        const auto prelink = options.base != nullptr && not options.prelinkCache.empty();
+        if (prelink)
+        {
+            auto prelinked = co_await detail::Offload{executor, [&] { return LoadPrelinked(*validated, options); }};
+            if (prelinked)
+            {
+                co_return std::move(prelinked);
+            }
+        }
+
+        auto mod = co_await detail::Offload{executor, [&] { return MapImage(*validated, options.base); }};
+        if (not mod)
+        {
+            co_return std::nullopt;
+        }
+
+        for (auto importDirectory = mod->ImportDirectory(); importDirectory && importDirectory->Characteristics;
+             ++importDirectory)
+        {
+            auto bound = co_await detail::Offload{executor, [&] {
+                const auto dll = reinterpret_cast<const char*>(&mod->Data()[importDirectory->Name]);
+                TraceScope trace{"loader", "dependency", dll};
+                auto module = LoadLibraryA(dll);
+                return module != nullptr && BindImport(*mod, *validated, *importDirectory, module);
+            }};
+
+            if (not bound)
+            {
+                co_return std::nullopt;
+            }
+        }
+
+        const auto finalized = co_await detail::Offload{executor, [&] {
+            Relocate(*mod, *validated);
+            if (prelink && mod->ImageBase() == options.base)
+            {
+                TraceScope store{"loader", "prelink store"};
+                PrelinkCache{options.prelinkCache}.Store(*validated, mod->Data(), mod->ImportModules());
+            }
+
+            return Finalize(*mod, options);
+        }};
+
+        if (not finalized)
+        {
+            co_return std::nullopt;
+        }
+
+        co_return std::move(mod);
+    }
+
 private:
-    bool LoadSection(BinaryWriter& bw, std::span<const std::uint8_t> data, const IMAGE_SECTION_HEADER* sectionHeader)
+    std::pmr::memory_resource* _resource;
+
+    std::optional<Module> LoadPrelinked(const ValidatedPE& validated, const LoadOptions& options)
     {
-        bw.Seek(sectionHeader->VirtualAddress);
-        bw << data;
+        TraceScope trace{"loader", "prelink"};
+        auto mapping = PrelinkCache{options.prelinkCache}.Map(validated, options.base, _resource);
+        if (not mapping)
+        {
+            return {};
+        }
 
-        return true;
+        std::optional<Module> mod{std::in_place, mapping->view, validated.Image().ImageSize(), _resource,
+                                  ModuleMemory::Mapped};
+        for (const auto module : mapping->imports)
+        {
+            mod->AddImportModule(module);
+        }
+
+        if (not mod->Ok() || Finalize(*mod, options) == false)
+        {
+            return {};
+        }
+
+        return mod;
+    }
+
+    static PVOID Allocate(std::size_t size, PVOID base)
+    {
+        auto memory = base ? VirtualAlloc(base, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE) : nullptr;
+        if (memory == nullptr)
+        {
+            memory = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_TOP_DOWN, PAGE_READWRITE);
+        }
+
+        return memory;
     }
 
-    bool BuildIAT(Module& mod)
+    std::optional<Module> MapImage(const ValidatedPE& validated, PVOID base = nullptr)
     {
+        TraceScope trace{"loader", "map"};
+        const auto& pe = validated.Image();
+
+        // alloc memory
+        auto memory = Allocate(pe.ImageSize(), base);
+        if (memory == nullptr)
+        {
+            return {};
+        }
+
+        // copy image headers; the layout was validated up front so the writer does not need to check again
+        BinaryWriter<UncheckedPolicy> bw{memory, pe.ImageSize(), MemoryState::Zeroed};
+        const auto rawData = pe.Data();
+        const auto sectionHeaders = pe.SectionHeaders();
+        const auto size = reinterpret_cast<const std::uint8_t*>(sectionHeaders.data() + sectionHeaders.size()) -
+                          rawData.data();
+
+        // the section table directly follows the headers, so both go out in one write
+        bw << rawData.first(size);
+
+        LoadSections(bw, rawData, pe.Sections());
+
+        std::optional<Module> mod{std::in_place, memory, pe.ImageSize(), _resource};
+        if (not mod->Ok())
+        {
+            return {};
+        }
+
+        return mod;
+    }
+
+    void LoadSections(BinaryWriter<UncheckedPolicy>& bw, std::span<const std::uint8_t> rawData,
+                      const SectionTable& sections)
+    {
+        std::pmr::vector<CopyRange> ranges{_resource};
+        ranges.reserve(sections.Size());
+
+        for (std::size_t i = 0; i < sections.Size(); ++i)
+        {
+            const auto rawSize = sections.RawSizes()[i];
+            const auto virtualSize = sections.VirtualSizes()[i];
+            ranges.push_back({sections.VirtualAddresses()[i], rawData.subspan(sections.RawPointers()[i], rawSize),
+                              virtualSize > rawSize ? virtualSize - rawSize : 0});
+        }
+
+        // one batch for the whole image so the copy engine can stream it past the cache in a single pass
+        bw.Gather(ranges);
+    }
+
+    bool BuildIAT(Module& mod, const ValidatedPE& validated)
+    {
+        TraceScope trace{"loader", "imports"};
         auto importDirectory = mod.ImportDirectory();
         if (importDirectory == nullptr)
         {
@@ -208,104 +801,255 @@ private:
         while (importDirectory->Characteristics)
         {
             const char* dll = reinterpret_cast<const char*>(&rawData[importDirectory->Name]);
+            TraceScope dependency{"loader", "dependency", dll};
 
             auto module = LoadLibraryA(dll);
-            if (module == nullptr)
+            if (module == nullptr || BindImport(mod, validated, *importDirectory, module) == false)
             {
                 return false;
             }
 
-            auto OFT = reinterpret_cast<std::size_t*>(&rawData[importDirectory->OriginalFirstThunk]);
-            if (importDirectory->OriginalFirstThunk == 0)
+            ++importDirectory;
+        }
+
+        return true;
+    }
+
+    bool BindImport(Module& mod, const ValidatedPE& validated, const IMAGE_IMPORT_DESCRIPTOR& importDirectory,
+                    HMODULE module)
+    {
+        if (Prebound(mod, validated, importDirectory, module))
+        {
+            mod.AddImportModule(module);
+            return true;
+        }
+
+        auto rawData = mod.Data();
+        auto OFT = reinterpret_cast<std::size_t*>(&rawData[importDirectory.OriginalFirstThunk]);
+        if (importDirectory.OriginalFirstThunk == 0)
+        {
+            OFT = reinterpret_cast<std::size_t*>(&rawData[importDirectory.FirstThunk]);
+        }
+
+        auto IAT = reinterpret_cast<std::uintptr_t*>(&rawData[importDirectory.FirstThunk]);
+
+        while (*OFT != 0)
+        {
+            std::uintptr_t function{};
+            if (IMAGE_SNAP_BY_ORDINAL(*OFT))
+            {
+                function = reinterpret_cast<std::uintptr_t>(
+                    GetProcAddress(module, reinterpret_cast<LPCSTR>(IMAGE_ORDINAL(*OFT))));
+            }
+            else
+            {
+                auto iin = reinterpret_cast<IMAGE_IMPORT_BY_NAME*>(&rawData[*OFT]);
+                function = reinterpret_cast<std::uintptr_t>(GetProcAddress(module, iin->Name));
+            }
+
+            if (function == 0)
             {
-                OFT = reinterpret_cast<std::size_t*>(&rawData[importDirectory->FirstThunk]);
+                return false;
             }
 
-            auto IAT = reinterpret_cast<std::uintptr_t*>(&rawData[importDirectory->FirstThunk]);
+            *IAT++ = function;
+            ++OFT;
+        }
+
+        mod.AddImportModule(module);
+        return true;
+    }
 
-            while (*OFT != 0)
+    // A bound import's IAT, copied from the file, already holds the addresses the dependency's exports had when the
+    // image was bound. They still hold when the dependency and every module it forwards to have the timestamps recorded
+    // in the bound import directory and were loaded at their preferred bases. A relocated module moves all of its
+    // exports by the same delta, so one import resolved by name shows whether the dependency moved, and checking that
+    // every entry lands inside one of the modules catches a forwarded-to module that moved.
+    bool Prebound(const Module& mod, const ValidatedPE& validated, const IMAGE_IMPORT_DESCRIPTOR& importDirectory,
+                  HMODULE module)
+    {
+        // -1 marks binding described by the bound import directory; the older form, with a forwarder chain in the
+        // descriptor, is always resolved by name
+        if (importDirectory.TimeDateStamp != 0xffffffff || importDirectory.OriginalFirstThunk == 0)
+        {
+            return false;
+        }
+
+        const auto bound = validated.FindBoundImport(validated.String(importDirectory.Name));
+        if (not bound || bound->timeDateStamp != detail::moduleHeaders(module)->FileHeader.TimeDateStamp)
+        {
+            return false;
+        }
+
+        std::pmr::vector<HMODULE> targets{_resource};
+        targets.reserve(bound->forwarders.size() + 1);
+        targets.push_back(module);
+        for (const auto& forwarder : bound->forwarders)
+        {
+            // the dependency loaded the modules it forwards to, so they are already in the process
+            const auto target = GetModuleHandleA(validated.BoundImportName(forwarder.OffsetModuleName).data());
+            if (target == nullptr || forwarder.TimeDateStamp != detail::moduleHeaders(target)->FileHeader.TimeDateStamp)
             {
-                std::uintptr_t function{};
-                if (IMAGE_SNAP_BY_ORDINAL(*OFT))
-                {
-                    function = reinterpret_cast<std::uintptr_t>(
-                        GetProcAddress(module, reinterpret_cast<LPCSTR>(IMAGE_ORDINAL(*OFT))));
-                }
-                else
-                {
-                    auto iin = reinterpret_cast<IMAGE_IMPORT_BY_NAME*>(&rawData[*OFT]);
-                    function = reinterpret_cast<std::uintptr_t>(GetProcAddress(module, iin->Name));
-                }
+                return false;
+            }
 
-                if (function == 0)
-                {
-                    return false;
-                }
+            targets.push_back(target);
+        }
 
-                *IAT++ = function;
-                ++OFT;
+        const auto rawData = mod.Data();
+        const auto lookup = validated.At<std::uint64_t>(importDirectory.OriginalFirstThunk);
+        const auto iat = reinterpret_cast<const std::uint64_t*>(&rawData[importDirectory.FirstThunk]);
+        if (lookup[0] == 0)
+        {
+            return true;
+        }
+
+        const auto probe = IMAGE_SNAP_BY_ORDINAL(lookup[0])
+                               ? reinterpret_cast<LPCSTR>(IMAGE_ORDINAL(lookup[0]))
+                               : validated.At<IMAGE_IMPORT_BY_NAME>(static_cast<std::uint32_t>(lookup[0]))->Name;
+        if (reinterpret_cast<std::uint64_t>(GetProcAddress(module, probe)) != iat[0])
+        {
+            return false;
+        }
+
+        for (std::size_t i = 0; lookup[i] != 0; ++i)
+        {
+            if (std::ranges::none_of(targets, [address = iat[i]](HMODULE target) {
+                    const auto base = reinterpret_cast<std::uint64_t>(target);
+                    return address - base < detail::moduleHeaders(target)->OptionalHeader.SizeOfImage;
+                }))
+            {
+                return false;
             }
+        }
 
-            mod.AddImportModule(module);
-            ++importDirectory;
+        return true;
+    }
+
+    void Relocate(Module& mod, const ValidatedPE& validated)
+    {
+        TraceScope trace{"loader", "relocate"};
+        auto delta = mod.NtHeader()->OptionalHeader.ImageBase - validated.Image().NtHeader()->OptionalHeader.ImageBase;
+        if (delta != 0)
+        {
+            RelocateBase(mod, validated, delta);
+        }
+    }
+
+    bool Finalize(Module& mod, const LoadOptions& options = {})
+    {
+        TraceScope trace{"loader", "finalize"};
+        if (FinalizeSection(mod) == false)
+        {
+            return false;
         }
 
+        Prefault(mod, options);
+        RunTLSCallbacks(mod);
+        mod.Register();
         return true;
     }
 
-    void RelocateBase(Module& mod, std::uint64_t delta)
+    // Touches every page of the selected sections once their final protection is set. Failures are not load errors:
+    // a page that could not be prefaulted or locked is simply faulted in on first access, as without the option.
+    void Prefault(Module& mod, const LoadOptions& options)
     {
-        auto relocTable = mod.RelocationDirectory();
-        if (relocTable == nullptr)
+        if (options.prefaultSections == 0)
         {
             return;
         }
 
-        auto base = mod.Data();
-        while (relocTable->VirtualAddress)
+        TraceScope trace{"loader", "prefault"};
+        auto imageBase = static_cast<std::uint8_t*>(mod.ImageBase());
+
+        std::pmr::vector<WIN32_MEMORY_RANGE_ENTRY> ranges{_resource};
+        std::pmr::vector<PSAPI_WORKING_SET_EX_INFORMATION> pages{_resource};
+        const auto& sections = mod.Sections();
+        for (std::size_t i = 0; i < sections.Size(); ++i)
         {
-            auto reloc = reinterpret_cast<const WORD*>(relocTable + 1);
-            while (*reloc)
+            const auto size = sections.VirtualSizes()[i];
+            if ((sections.Characteristics()[i] & options.prefaultSections) == 0 || size == 0)
             {
-                auto dest = &base[relocTable->VirtualAddress + (*reloc & 0xfff)];
-                switch (auto type = *reloc >> 12; type)
-                {
-                case IMAGE_REL_BASED_DIR64:
-                    *reinterpret_cast<std::uint64_t*>(dest) += delta;
-                    break;
-                }
+                continue;
+            }
 
-                ++reloc;
+            const auto begin = imageBase + sections.VirtualAddresses()[i];
+            ranges.push_back({begin, size});
+            for (std::size_t offset = 0; offset < size; offset += detail::pageSize)
+            {
+                pages.push_back({begin + offset, {}});
             }
+        }
+
+        if (pages.empty())
+        {
+            return;
+        }
+
+        PrefaultStats stats{};
+        stats.pages = pages.size();
 
-            relocTable = reinterpret_cast<decltype(relocTable)>(reinterpret_cast<std::uintptr_t>(relocTable) +
-                                                                relocTable->SizeOfBlock);
+        // a page that is not valid in the working set yet is one the first access would have faulted on
+        if (QueryWorkingSetEx(GetCurrentProcess(), pages.data(),
+                              static_cast<DWORD>(pages.size() * sizeof(PSAPI_WORKING_SET_EX_INFORMATION))))
+        {
+            stats.faultsAvoided = static_cast<std::size_t>(
+                std::ranges::count_if(pages, [](const auto& page) { return page.VirtualAttributes.Valid == 0; }));
+        }
+
+        // the prefetch reads a file-backed view in a few large I/Os; the reads below then map every page, which the
+        // prefetch alone leaves to a soft fault on first access
+        PrefetchVirtualMemory(GetCurrentProcess(), ranges.size(), ranges.data(), 0);
+        for (const auto& page : pages)
+        {
+            static_cast<void>(*static_cast<const volatile std::uint8_t*>(page.VirtualAddress));
         }
+
+        if (options.lockPrefaulted)
+        {
+            for (const auto& range : ranges)
+            {
+                if (VirtualLock(range.VirtualAddress, range.NumberOfBytes))
+                {
+                    const auto pages = (range.NumberOfBytes + detail::pageSize - 1) / detail::pageSize;
+                    stats.lockedBytes += pages * detail::pageSize;
+                }
+            }
+        }
+
+        mod.SetPrefaulted(stats);
+    }
+
+    void RelocateBase(Module& mod, const ValidatedPE& validated, std::uint64_t delta)
+    {
+        // every site was bounds-checked against SizeOfImage by the validator and is known to be DIR64
+        auto base = mod.Data().data();
+        validated.ForEachRelocation([base, delta](std::uint32_t rva, auto) {
+            *reinterpret_cast<std::uint64_t*>(base + rva) += delta;
+        });
     }
 
     bool FinalizeSection(Module& mod)
     {
-        auto isBitSet = [&](auto flags, auto flag) { return (flags & flag) == flag; };
         auto imageBase = static_cast<std::uint8_t*>(mod.ImageBase());
 
-        for (auto sectionHeader : mod.SectionHeaders())
+        const auto& sections = mod.Sections();
+        for (std::size_t i = 0; i < sections.Size(); ++i)
         {
-            auto isWritable = isBitSet(sectionHeader->Characteristics, IMAGE_SCN_MEM_WRITE);
-            auto isExecutable = isBitSet(sectionHeader->Characteristics, IMAGE_SCN_MEM_EXECUTE);
+            auto newProtect = detail::sectionProtection(sections.Characteristics()[i]);
 
-            DWORD newProtect{};
-
-            if (isWritable)
+            // a file-backed view can only be made writable as copy-on-write
+            if (mod.Memory() == ModuleMemory::Mapped && newProtect == PAGE_READWRITE)
             {
-                newProtect = isExecutable ? PAGE_EXECUTE_READWRITE : PAGE_READWRITE;
+                newProtect = PAGE_WRITECOPY;
             }
-            else
+            else if (mod.Memory() == ModuleMemory::Mapped && newProtect == PAGE_EXECUTE_READWRITE)
             {
-                newProtect = isExecutable ? PAGE_EXECUTE_READ : PAGE_READONLY;
+                newProtect = PAGE_EXECUTE_WRITECOPY;
             }
 
             DWORD oldProtect{};
-            auto result = VirtualProtect(imageBase + sectionHeader->VirtualAddress, sectionHeader->Misc.VirtualSize,
+            auto result = VirtualProtect(imageBase + sections.VirtualAddresses()[i], sections.VirtualSizes()[i],
                                          newProtect, &oldProtect);
 
             if (result == FALSE)
@@ -0,0 +1,335 @@
+#pragma once
+
+#include "validator.hpp"
+
+#include <Windows.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Torpedo
+{
+
+struct PlanCopy
+{
+    std::uint32_t fileOffset;
+    std::uint32_t rva;
+    std::uint32_t size;
+};
+
+struct PlanLibrary
+{
+    // offset into LoadPlan::strings
+    std::uint32_t name;
+};
+
+struct PlanImport
+{
+    std::uint32_t iatRva;
+    std::uint32_t library;
+    // offset into LoadPlan::strings, or the ordinal when byOrdinal is set
+    std::uint32_t symbol;
+    std::uint32_t byOrdinal;
+};
+
+struct PlanProtection
+{
+    std::uint32_t rva;
+    std::uint32_t size;
+    std::uint32_t protect;
+};
+
+// Everything ModuleLoader needs to map one image, precomputed from a validated PE: which file bytes go where, every
+// DIR64 relocation site, every IAT slot with its symbol name already interned, and page-rounded protection runs.
+// Replaying a plan touches no PE header or .reloc block of the source file. Relocation sites are stored as LEB128
+// deltas between ascending RVAs, which keeps a typical site at one or two bytes.
+struct LoadPlan
+{
+    std::uint64_t preferredBase{};
+    std::uint32_t imageSize{};
+    // the plan only applies to the exact file it was compiled from
+    std::uint64_t fileSize{};
+    std::uint64_t fileDigest{};
+    std::pmr::vector<PlanCopy> copies;
+    std::pmr::vector<std::uint8_t> relocations;
+    std::pmr::vector<PlanLibrary> libraries;
+    std::pmr::vector<PlanImport> imports;
+    std::pmr::vector<PlanProtection> protections;
+    std::pmr::vector<char> strings;
+
+    LoadPlan(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : copies{resource}, relocations{resource}, libraries{resource}, imports{resource}, protections{resource},
+          strings{resource}
+    {
+    }
+
+    [[nodiscard]] const char* String(std::uint32_t offset) const noexcept { return strings.data() + offset; }
+
+    // Calls f(rva) for every relocation site.
+    template<typename F> void ForEachRelocation(F&& f) const
+    {
+        std::uint32_t rva{};
+        for (std::size_t i = 0; i < relocations.size();)
+        {
+            std::uint32_t delta{};
+            for (unsigned shift = 0; i < relocations.size(); shift += 7)
+            {
+                const auto byte = relocations[i++];
+                if (shift < 32)
+                {
+                    delta |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+                }
+
+                if ((byte & 0x80) == 0)
+                {
+                    break;
+                }
+            }
+
+            rva += delta;
+            f(rva);
+        }
+    }
+
+    [[nodiscard]] std::pmr::vector<std::uint8_t> Serialize() const
+    {
+        std::pmr::vector<std::uint8_t> out{copies.get_allocator()};
+        const auto put = [&out](const auto& value) {
+            const auto bytes = reinterpret_cast<const std::uint8_t*>(&value);
+            out.insert(out.end(), bytes, bytes + sizeof(value));
+        };
+        const auto putArray = [&out, &put](const auto& array) {
+            put(static_cast<std::uint32_t>(array.size()));
+            const auto bytes = reinterpret_cast<const std::uint8_t*>(array.data());
+            out.insert(out.end(), bytes, bytes + array.size() * sizeof(array[0]));
+        };
+
+        put(Magic);
+        put(Version);
+        put(preferredBase);
+        put(imageSize);
+        put(fileSize);
+        put(fileDigest);
+        putArray(copies);
+        putArray(relocations);
+        putArray(libraries);
+        putArray(imports);
+        putArray(protections);
+        putArray(strings);
+        return out;
+    }
+
+    // Parses a serialized plan and checks that every range it describes stays inside the image, the file and its own
+    // string pool and that ordinals fit in 16 bits, so a corrupt or hostile plan cannot make a replay write or read out
+    // of bounds.
+    [[nodiscard]] static std::optional<LoadPlan> Deserialize(
+        std::span<const std::uint8_t> data, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    {
+        LoadPlan plan{resource};
+        const auto get = [&data](auto& value) {
+            if (data.size() < sizeof(value))
+            {
+                return false;
+            }
+
+            std::memcpy(&value, data.data(), sizeof(value));
+            data = data.subspan(sizeof(value));
+            return true;
+        };
+        const auto getArray = [&data, &get](auto& array) {
+            std::uint32_t count{};
+            if (not get(count) || data.size() / sizeof(array[0]) < count)
+            {
+                return false;
+            }
+
+            array.resize(count);
+            std::copy_n(data.begin(), count * sizeof(array[0]), reinterpret_cast<std::uint8_t*>(array.data()));
+            data = data.subspan(count * sizeof(array[0]));
+            return true;
+        };
+
+        std::uint32_t magic{};
+        std::uint32_t version{};
+        if (not get(magic) || magic != Magic || not get(version) || version != Version || not get(plan.preferredBase) ||
+            not get(plan.imageSize) || not get(plan.fileSize) || not get(plan.fileDigest) ||
+            not getArray(plan.copies) || not getArray(plan.relocations) || not getArray(plan.libraries) ||
+            not getArray(plan.imports) || not getArray(plan.protections) || not getArray(plan.strings) ||
+            not plan.Consistent())
+        {
+            return {};
+        }
+
+        return plan;
+    }
+
+private:
+    static constexpr std::uint32_t Magic = 0x4e4c5054; // "TPLN"
+    static constexpr std::uint32_t Version = 1;
+
+    bool Consistent() const
+    {
+        const auto within = [](std::uint64_t offset, std::uint64_t size, std::uint64_t limit) {
+            return offset <= limit && size <= limit - offset;
+        };
+        const auto validString = [this](std::uint32_t offset) {
+            return offset < strings.size() && std::find(strings.begin() + offset, strings.end(), '\0') != strings.end();
+        };
+
+        bool consistent = true;
+        ForEachRelocation([&](std::uint32_t rva) {
+            consistent = consistent && within(rva, sizeof(std::uint64_t), imageSize);
+        });
+
+        return consistent &&
+               std::ranges::all_of(copies, [&](const auto& copy) {
+                   return within(copy.fileOffset, copy.size, fileSize) && within(copy.rva, copy.size, imageSize);
+               }) &&
+               std::ranges::all_of(libraries, [&](const auto& library) { return validString(library.name); }) &&
+               std::ranges::all_of(imports, [&](const auto& import) {
+                   return within(import.iatRva, sizeof(std::uint64_t), imageSize) &&
+                          import.library < libraries.size() && import.byOrdinal <= 1 &&
+                          // GetProcAddress reads any value above 0xffff as a name pointer
+                          (import.byOrdinal ? import.symbol <= 0xffff : validString(import.symbol));
+               }) &&
+               std::ranges::all_of(protections, [&](const auto& run) {
+                   return within(run.rva, run.size, imageSize) &&
+                          (run.protect == PAGE_READONLY || run.protect == PAGE_READWRITE ||
+                           run.protect == PAGE_EXECUTE_READ || run.protect == PAGE_EXECUTE_READWRITE);
+               });
+    }
+};
+
+namespace detail
+{
+
+inline DWORD sectionProtection(DWORD characteristics) noexcept
+{
+    const auto isWritable = (characteristics & IMAGE_SCN_MEM_WRITE) == IMAGE_SCN_MEM_WRITE;
+    const auto isExecutable = (characteristics & IMAGE_SCN_MEM_EXECUTE) == IMAGE_SCN_MEM_EXECUTE;
+    if (isWritable)
+    {
+        return isExecutable ? PAGE_EXECUTE_READWRITE : PAGE_READWRITE;
+    }
+
+    return isExecutable ? PAGE_EXECUTE_READ : PAGE_READONLY;
+}
+
+} // namespace detail
+
+// Compiles `validated` into a LoadPlan. Identical names across libraries and imports are interned once.
+[[nodiscard]] inline LoadPlan CompileLoadPlan(const ValidatedPE& validated,
+                                              std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+{
+    const auto& pe = validated.Image();
+    LoadPlan plan{resource};
+    plan.preferredBase = pe.NtHeader()->OptionalHeader.ImageBase;
+    plan.imageSize = pe.ImageSize();
+    plan.fileSize = pe.Data().size();
+    plan.fileDigest = pe.Pages().Digest();
+
+    // the same layout MapImage produces: headers up to the end of the section table, then every section's raw data
+    const auto sectionHeaders = pe.SectionHeaders();
+    const auto headerSize = reinterpret_cast<const std::uint8_t*>(sectionHeaders.data() + sectionHeaders.size()) -
+                            pe.Data().data();
+    plan.copies.push_back({0, 0, static_cast<std::uint32_t>(headerSize)});
+
+    const auto& sections = pe.Sections();
+    for (std::size_t i = 0; i < sections.Size(); ++i)
+    {
+        if (sections.RawSizes()[i] != 0)
+        {
+            plan.copies.push_back({sections.RawPointers()[i], sections.VirtualAddresses()[i], sections.RawSizes()[i]});
+        }
+    }
+
+    std::pmr::vector<std::uint32_t> sites{resource};
+    validated.ForEachRelocation([&sites](std::uint32_t rva, auto) { sites.push_back(rva); });
+    std::ranges::sort(sites);
+
+    std::uint32_t previous{};
+    for (const auto site : sites)
+    {
+        for (auto delta = site - previous;; delta >>= 7)
+        {
+            if (delta < 0x80)
+            {
+                plan.relocations.push_back(static_cast<std::uint8_t>(delta));
+                break;
+            }
+
+            plan.relocations.push_back(static_cast<std::uint8_t>(delta | 0x80));
+        }
+
+        previous = site;
+    }
+
+    std::pmr::unordered_map<std::string_view, std::uint32_t> interned{resource};
+    const auto intern = [&](std::string_view name) {
+        auto [entry, inserted] = interned.try_emplace(name, static_cast<std::uint32_t>(plan.strings.size()));
+        if (inserted)
+        {
+            plan.strings.insert(plan.strings.end(), name.begin(), name.end());
+            plan.strings.push_back('\0');
+        }
+
+        return entry->second;
+    };
+
+    for (const auto& descriptor : validated.ImportDescriptors())
+    {
+        const auto library = static_cast<std::uint32_t>(plan.libraries.size());
+        plan.libraries.push_back({intern(validated.String(descriptor.Name))});
+
+        auto iatRva = descriptor.FirstThunk;
+        auto thunk = validated.At<std::uint64_t>(descriptor.OriginalFirstThunk ? descriptor.OriginalFirstThunk
+                                                                               : descriptor.FirstThunk);
+        for (; *thunk != 0; ++thunk, iatRva += sizeof(std::uint64_t))
+        {
+            if (IMAGE_SNAP_BY_ORDINAL(*thunk))
+            {
+                plan.imports.push_back({iatRva, library, static_cast<std::uint32_t>(IMAGE_ORDINAL(*thunk)), 1});
+            }
+            else
+            {
+                const auto importByName = validated.At<IMAGE_IMPORT_BY_NAME>(static_cast<std::uint32_t>(*thunk));
+                plan.imports.push_back({iatRva, library, intern(importByName->Name), 0});
+            }
+        }
+    }
+
+    // page-round every section and merge neighbours that end up with the same protection
+    constexpr std::uint32_t pageSize = 0x1000;
+    for (std::size_t i = 0; i < sections.Size(); ++i)
+    {
+        const auto begin = sections.VirtualAddresses()[i] & ~(pageSize - 1);
+        const auto end =
+            (sections.VirtualAddresses()[i] + sections.VirtualSizes()[i] + pageSize - 1) & ~(pageSize - 1);
+        const auto protect = detail::sectionProtection(sections.Characteristics()[i]);
+        if (begin == end)
+        {
+            continue;
+        }
+
+        if (not plan.protections.empty() && plan.protections.back().protect == protect &&
+            plan.protections.back().rva + plan.protections.back().size == begin)
+        {
+            plan.protections.back().size = end - plan.protections.back().rva;
+        }
+        else
+        {
+            plan.protections.push_back({begin, end - begin, protect});
+        }
+    }
+
+    return plan;
+}
+
+} // namespace Torpedo
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "pe.hpp"
+#include "validator.hpp"
+
+#include <Windows.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <string_view>
+
+namespace Torpedo
+{
+
+namespace detail
+{
+
+// Formats as a quoted JSON string. Names in a PE are arbitrary bytes, so everything outside printable ASCII is
+// escaped; the output is always valid JSON even for malformed images.
+struct JsonString
+{
+    std::string_view value;
+};
+
+constexpr std::array<std::string_view, IMAGE_NUMBEROF_DIRECTORY_ENTRIES> directoryNames{
+    "export", "import", "resource", "exception", "security", "basereloc", "debug",
+    "architecture", "globalptr", "tls", "load_config", "bound_import", "iat", "delay_import", "com_descriptor",
+    "reserved"};
+
+} // namespace detail
+
+} // namespace Torpedo
+
+template<> struct std::formatter<Torpedo::detail::JsonString, char>
+{
+    constexpr auto parse(std::format_parse_context& context) { return context.begin(); }
+
+    template<typename FormatContext>
+    auto format(const Torpedo::detail::JsonString& string, FormatContext& context) const
+    {
+        constexpr auto plain = [](char c) { return c >= 0x20 && c < 0x7f && c != '"' && c != '\\'; };
+
+        auto out = context.out();
+        *out++ = '"';
+
+        // copy runs of plain characters in one go and escape the rest
+        auto value = string.value;
+        while (not value.empty())
+        {
+            const auto run = std::ranges::find_if_not(value, plain) - value.begin();
+            out = std::ranges::copy(value.substr(0, run), out).out;
+            value.remove_prefix(run);
+            if (value.empty())
+            {
+                break;
+            }
+
+            const auto c = static_cast<unsigned char>(value.front());
+            if (c == '"' || c == '\\')
+            {
+                *out++ = '\\';
+                *out++ = static_cast<char>(c);
+            }
+            else
+            {
+                out = std::format_to(out, "\\u{:04x}", c);
+            }
+
+            value.remove_prefix(1);
+        }
+
+        *out++ = '"';
+        return out;
+    }
+};
+
+namespace Torpedo
+{
+
+// Writes one JSON object per line describing `pe`: a "file" record with the header fields, then "directory",
+// "section" and "import" records in file order, then "export" records sorted by name. Every record carries `source`,
+// so lines from several images can be merged downstream. The text goes straight to `out` with no intermediate
+// strings; the only allocation is the export index, built on first use from the PE's memory resource.
+template<std::output_iterator<char> Out> Out FormatNdjson(Out out, const PE& pe, std::string_view source)
+{
+    using detail::JsonString;
+
+    if (not pe.Ok())
+    {
+        return std::format_to(out, "{{\"type\":\"error\",\"source\":{},\"error\":{}}}\n", JsonString{source},
+                              static_cast<int>(pe.Error()));
+    }
+
+    const auto validated = Validate(pe);
+    const auto& fileHeader = pe.NtHeader()->FileHeader;
+    const auto& optionalHeader = pe.NtHeader()->OptionalHeader;
+    out = std::format_to(out,
+                         "{{\"type\":\"file\",\"source\":{},\"machine\":{},\"characteristics\":{},\"timestamp\":{},"
+                         "\"image_base\":{},\"image_size\":{},\"headers_size\":{},\"entry_point\":{},\"subsystem\":{},"
+                         "\"dll_characteristics\":{},\"sections\":{},\"valid\":{}}}\n",
+                         JsonString{source}, fileHeader.Machine, fileHeader.Characteristics, fileHeader.TimeDateStamp,
+                         optionalHeader.ImageBase, optionalHeader.SizeOfImage, optionalHeader.SizeOfHeaders,
+                         optionalHeader.AddressOfEntryPoint, optionalHeader.Subsystem,
+                         optionalHeader.DllCharacteristics, pe.Sections().Size(), validated.has_value());
+
+    const auto directoryCount =
+        std::min<std::size_t>(optionalHeader.NumberOfRvaAndSizes, IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+    for (std::size_t i = 0; i < directoryCount; ++i)
+    {
+        if (const auto& directory = optionalHeader.DataDirectory[i]; directory.Size != 0)
+        {
+            out = std::format_to(out,
+                                 "{{\"type\":\"directory\",\"source\":{},\"name\":\"{}\",\"rva\":{},\"size\":{}}}\n",
+                                 JsonString{source}, detail::directoryNames[i], directory.VirtualAddress,
+                                 directory.Size);
+        }
+    }
+
+    for (const auto& sectionHeader : pe.SectionHeaders())
+    {
+        const auto name = reinterpret_cast<const char*>(sectionHeader.Name);
+        out = std::format_to(out,
+                             "{{\"type\":\"section\",\"source\":{},\"name\":{},\"rva\":{},\"virtual_size\":{},"
+                             "\"raw_pointer\":{},\"raw_size\":{},\"characteristics\":{}}}\n",
+                             JsonString{source},
+                             JsonString{{name, static_cast<std::size_t>(std::ranges::find(sectionHeader.Name, 0) -
+                                                                        std::begin(sectionHeader.Name))}},
+                             sectionHeader.VirtualAddress, sectionHeader.Misc.VirtualSize,
+                             sectionHeader.PointerToRawData, sectionHeader.SizeOfRawData,
+                             sectionHeader.Characteristics);
+    }
+
+    // thunk chains are only walked once the validator has bounded them
+    if (validated)
+    {
+        for (const auto& descriptor : validated->ImportDescriptors())
+        {
+            const auto dll = validated->String(descriptor.Name);
+            auto thunk = validated->At<std::uint64_t>(descriptor.OriginalFirstThunk ? descriptor.OriginalFirstThunk
+                                                                                   : descriptor.FirstThunk);
+            for (; *thunk != 0; ++thunk)
+            {
+                if (IMAGE_SNAP_BY_ORDINAL(*thunk))
+                {
+                    out = std::format_to(out, "{{\"type\":\"import\",\"source\":{},\"dll\":{},\"ordinal\":{}}}\n",
+                                         JsonString{source}, JsonString{dll}, IMAGE_ORDINAL(*thunk));
+                }
+                else
+                {
+                    const auto importByName = validated->At<IMAGE_IMPORT_BY_NAME>(static_cast<std::uint32_t>(*thunk));
+                    out = std::format_to(out, "{{\"type\":\"import\",\"source\":{},\"dll\":{},\"name\":{}}}\n",
+                                         JsonString{source}, JsonString{dll},
+                                         JsonString{std::string_view{importByName->Name}});
+                }
+            }
+        }
+    }
+
+    for (const auto& entry : pe.Exports().Entries())
+    {
+        out = std::format_to(out, "{{\"type\":\"export\",\"source\":{},\"name\":{},\"ordinal\":{},\"rva\":{}}}\n",
+                             JsonString{source}, JsonString{entry.name}, entry.ordinal, entry.rva);
+    }
+
+    return out;
+}
+
+} // namespace Torpedo
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+namespace Torpedo
+{
+
+struct FileRange
+{
+    std::size_t offset{};
+    std::size_t size{};
+};
+
+namespace detail
+{
+
+constexpr std::uint64_t HashPrime1 = 0x9e3779b185ebca87;
+constexpr std::uint64_t HashPrime2 = 0xc2b2ae3d27d4eb4f;
+constexpr std::size_t hashedPageSize = 0x1000;
+
+// 64-bit hash of one page. Four independent lanes keep the multiplies pipelined; this only has to tell pages apart,
+// not resist adversaries.
+inline std::uint64_t hashPage(std::span<const std::uint8_t> page) noexcept
+{
+    std::uint64_t lanes[4]{HashPrime1, HashPrime2, ~HashPrime1, ~HashPrime2};
+    const auto round = [](std::uint64_t lane, std::uint64_t word) {
+        return std::rotl(lane + word * HashPrime2, 31) * HashPrime1;
+    };
+
+    std::size_t i = 0;
+    for (; i + 32 <= page.size(); i += 32)
+    {
+        std::uint64_t words[4];
+        std::memcpy(words, page.data() + i, sizeof(words));
+        for (std::size_t lane = 0; lane < 4; ++lane)
+        {
+            lanes[lane] = round(lanes[lane], words[lane]);
+        }
+    }
+
+    // the last page of a file may be short; zero-pad it and mix in the length so padding cannot collide
+    if (i < page.size())
+    {
+        std::uint64_t words[4]{};
+        std::memcpy(words, page.data() + i, page.size() - i);
+        for (std::size_t lane = 0; lane < 4; ++lane)
+        {
+            lanes[lane] = round(lanes[lane], words[lane]);
+        }
+    }
+
+    auto hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+    hash ^= page.size() * HashPrime1;
+    hash ^= hash >> 33;
+    hash *= HashPrime2;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+// Offsets of the pages that differ between two hash lists, merged where adjacent and sorted. Pages that exist in only
+// one of the two count as changed.
+inline std::pmr::vector<FileRange> diffPages(std::span<const std::uint64_t> current,
+                                             std::span<const std::uint64_t> previous,
+                                             std::pmr::polymorphic_allocator<> allocator)
+{
+    std::pmr::vector<FileRange> changed{allocator};
+    const auto pages = std::max(current.size(), previous.size());
+    for (std::size_t page = 0; page < pages; ++page)
+    {
+        if (page < current.size() && page < previous.size() && current[page] == previous[page])
+        {
+            continue;
+        }
+
+        if (not changed.empty() && changed.back().offset + changed.back().size == page * hashedPageSize)
+        {
+            changed.back().size += hashedPageSize;
+        }
+        else
+        {
+            changed.push_back({page * hashedPageSize, hashedPageSize});
+        }
+    }
+
+    return changed;
+}
+
+} // namespace detail
+
+// One hash per 4 KiB page of a file, so two versions of a file can be compared without keeping both around.
+class PageHashes
+{
+public:
+    static constexpr std::size_t PageSize = detail::hashedPageSize;
+
+    PageHashes(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : _hashes{resource} {}
+
+    void Build(std::span<const std::uint8_t> data)
+    {
+        _dataSize = data.size();
+        _hashes.resize((data.size() + PageSize - 1) / PageSize);
+        for (std::size_t page = 0; page < _hashes.size(); ++page)
+        {
+            const auto offset = page * PageSize;
+            _hashes[page] = detail::hashPage(data.subspan(offset, std::min(PageSize, data.size() - offset)));
+        }
+    }
+
+    [[nodiscard]] constexpr std::size_t DataSize() const noexcept { return _dataSize; }
+    [[nodiscard]] std::span<const std::uint64_t> Hashes() const noexcept { return _hashes; }
+
+    // Single value identifying the whole file, e.g. as a cache key.
+    [[nodiscard]] std::uint64_t Digest() const noexcept
+    {
+        return detail::hashPage({reinterpret_cast<const std::uint8_t*>(_hashes.data()),
+                                 _hashes.size() * sizeof(std::uint64_t)}) ^
+               _dataSize;
+    }
+
+    // File ranges of this version that differ from `previous`, merged where adjacent and sorted by offset. Pages that
+    // exist in only one of the two versions count as changed.
+    [[nodiscard]] std::pmr::vector<FileRange> Diff(const PageHashes& previous) const
+    {
+        return detail::diffPages(_hashes, previous._hashes, _hashes.get_allocator());
+    }
+
+private:
+    std::pmr::vector<std::uint64_t> _hashes;
+    std::size_t _dataSize{};
+};
+
+namespace detail
+{
+
+// `changed` must be sorted and non-overlapping, as returned by PageHashes::Diff.
+inline bool overlaps(std::span<const FileRange> changed, std::size_t offset, std::size_t size) noexcept
+{
+    auto range = std::ranges::upper_bound(changed, offset, {}, &FileRange::offset);
+    if (range != changed.begin() && offset - std::prev(range)->offset < std::prev(range)->size)
+    {
+        return true;
+    }
+
+    return range != changed.end() && range->offset - offset < size;
+}
+
+} // namespace detail
+
+} // namespace Torpedo
@@ -1,12 +1,21 @@
 #pragma once
 
+#include "exportindex.hpp"
+#include "lazy.hpp"
+#include "pagehash.hpp"
 #include "peerror.hpp"
+#include "sectiontable.hpp"
 #include "streamreader.hpp"
 
 #include <Windows.h>
+#include <algorithm>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
-#include <ranges>
+#include <istream>
+#include <memory>
+#include <memory_resource>
+#include <span>
 #include <vector>
 
 namespace Torpedo
@@ -20,17 +29,36 @@ constexpr bool inBetween(auto x, auto lb, auto ub)
     return (lb <= x) && (x < ub);
 }
 
-constexpr bool rvaInSection(std::uint32_t rva, const IMAGE_SECTION_HEADER* header)
+// Entries past NumberOfRvaAndSizes are not part of the image, whatever bytes happen to be there.
+constexpr IMAGE_DATA_DIRECTORY dataDirectory(const IMAGE_OPTIONAL_HEADER64& header, int index) noexcept
 {
-    return inBetween(rva, header->VirtualAddress, header->VirtualAddress + header->Misc.VirtualSize);
+    if (index < 0 || index >= static_cast<int>(std::min<DWORD>(header.NumberOfRvaAndSizes,
+                                                                 IMAGE_NUMBEROF_DIRECTORY_ENTRIES)))
+    {
+        return {};
+    }
+
+    return header.DataDirectory[index];
+}
+
+// headers of a module the OS loader mapped
+inline const IMAGE_NT_HEADERS* moduleHeaders(HMODULE module) noexcept
+{
+    const auto base = reinterpret_cast<const std::uint8_t*>(module);
+    return reinterpret_cast<const IMAGE_NT_HEADERS*>(base + reinterpret_cast<const IMAGE_DOS_HEADER*>(base)->e_lfanew);
 }
 
 } // namespace detail
 
+// A parsed PE never changes after construction, so every const member may be called from any number of threads at
+// once. Indexes built on first use (Exports, Pages) are published lock-free, but are allocated from the PE's memory
+// resource, so a PE shared between threads needs a thread-safe one: the default heap or a synchronized_pool_resource,
+// not a monotonic_buffer_resource. Share one parse between threads through Open.
 class PE
 {
 public:
-    PE(const std::filesystem::path& path) noexcept
+    PE(const std::filesystem::path& path, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : _sections{resource}, _data{resource}, _exports{resource}, _pages{resource}
     {
         std::ifstream ifs{path, std::ios_base::in | std::ios_base::binary};
         if (not ifs.is_open())
@@ -38,10 +66,62 @@ public:
             return;
         }
 
+        std::error_code ec;
+        if (auto size = std::filesystem::file_size(path, ec); not ec)
+        {
+            _data.reserve(size);
+        }
+
         Parse(ifs);
     }
 
-    constexpr ~PE() noexcept { _ok = false; }
+    // Reads the image from any stream, including pipes and stdin whose size is not known up front.
+    PE(std::istream& stream, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : _sections{resource}, _data{resource}, _exports{resource}, _pages{resource}
+    {
+        Parse(stream);
+    }
+
+    // the headers point into _data, so a copy would alias the original's buffer
+    PE(const PE&) = delete;
+    PE& operator=(const PE&) = delete;
+
+    ~PE() noexcept { _ok = false; }
+
+    [[nodiscard]] static std::shared_ptr<const PE> Open(
+        const std::filesystem::path& path, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    {
+        return std::make_shared<const PE>(path, resource);
+    }
+
+    [[nodiscard]] static std::shared_ptr<const PE> Open(
+        std::istream& stream, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    {
+        return std::make_shared<const PE>(stream, resource);
+    }
+
+    // Re-reads `path` after it changed on disk. The new contents are compared with `previous` page by page; when no
+    // page differs `previous` itself is returned, otherwise structures that lie entirely in unchanged pages (so far
+    // the export index) are carried over instead of being decoded again.
+    [[nodiscard]] static std::shared_ptr<const PE> Refresh(
+        const std::shared_ptr<const PE>& previous, const std::filesystem::path& path,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    {
+        auto next = Open(path, resource);
+        if (not previous->Ok() || not next->Ok())
+        {
+            return next;
+        }
+
+        const auto changed = next->Pages().Diff(previous->Pages());
+        if (changed.empty())
+        {
+            return previous;
+        }
+
+        next->ReuseExports(*previous, changed);
+        return next;
+    }
 
     [[nodiscard]] constexpr bool Ok() const noexcept { return _ok; }
 
@@ -58,19 +138,90 @@ public:
         auto importDirectoryRaw = Rva2Raw(importDataDirectory.VirtualAddress);
         return reinterpret_cast<const IMAGE_IMPORT_DESCRIPTOR*>(_data.data() + importDirectoryRaw);
     }
-    [[nodiscard]] constexpr const auto& SectionHeaders() const noexcept { return _sectionHeaders; }
+    [[nodiscard]] constexpr std::span<const IMAGE_SECTION_HEADER> SectionHeaders() const noexcept
+    {
+        return _sectionHeaders;
+    }
+    [[nodiscard]] constexpr const SectionTable& Sections() const noexcept { return _sections; }
     [[nodiscard]] constexpr std::span<const std::uint8_t> Data() const noexcept { return _data; }
 
+    [[nodiscard]] const IMAGE_EXPORT_DIRECTORY* ExportDirectory() const noexcept
+    {
+        auto exportDataDirectory = DataDirectory(IMAGE_DIRECTORY_ENTRY_EXPORT);
+        if (exportDataDirectory.Size == 0)
+        {
+            return nullptr;
+        }
+
+        return Map<IMAGE_EXPORT_DIRECTORY>(exportDataDirectory.VirtualAddress);
+    }
+
+    [[nodiscard]] const ExportIndex& Exports() const
+    {
+        return _exports.Get([this] { return BuildExports(); });
+    }
+
+    [[nodiscard]] const PageHashes& Pages() const
+    {
+        return _pages.Get([this] {
+            PageHashes pages{_data.get_allocator().resource()};
+            pages.Build(_data);
+            return pages;
+        });
+    }
+
+    // Returns the raw bytes from `rva` to the end of the header or section data backing it. Anything that lies within
+    // that extent also appears at the same RVA once the image is mapped.
+    [[nodiscard]] std::span<const std::uint8_t> MappedExtent(std::uint64_t rva) const noexcept
+    {
+        const std::span<const std::uint8_t> data{_data};
+        if (const auto sizeOfHeaders = std::min<std::uint64_t>(_ntHeader->OptionalHeader.SizeOfHeaders, data.size());
+            rva < sizeOfHeaders)
+        {
+            return data.subspan(static_cast<std::size_t>(rva), static_cast<std::size_t>(sizeOfHeaders - rva));
+        }
+
+        if (rva > UINT32_MAX)
+        {
+            return {};
+        }
+
+        const auto section = _sections.FindRaw(static_cast<std::uint32_t>(rva));
+        if (not section)
+        {
+            return {};
+        }
+
+        const auto offset = rva - _sections.VirtualAddresses()[*section];
+        const auto rawPointer = std::uint64_t{_sections.RawPointers()[*section]};
+        const auto rawSize = std::uint64_t{_sections.RawSizes()[*section]};
+        if (rawPointer + rawSize > data.size())
+        {
+            return {};
+        }
+
+        return data.subspan(static_cast<std::size_t>(rawPointer + offset), static_cast<std::size_t>(rawSize - offset));
+    }
+
+    // Bounds-checked view of `count` objects at `rva`, or nullptr if they are not all backed by file data.
+    template<typename T> [[nodiscard]] const T* Map(std::uint64_t rva, std::uint64_t count = 1) const noexcept
+    {
+        const auto extent = MappedExtent(rva);
+        if (extent.empty() || count * sizeof(T) > extent.size())
+        {
+            return nullptr;
+        }
+
+        return reinterpret_cast<const T*>(extent.data());
+    }
+
     [[nodiscard]] constexpr auto ImageSize() const noexcept { return _ntHeader->OptionalHeader.SizeOfImage; }
 
     std::uint32_t Rva2Raw(const std::uint32_t rva) const
     {
-        if (auto section = std::ranges::find_if(
-                _sectionHeaders, [rva](const auto& sectionHeader) { return detail::rvaInSection(rva, sectionHeader); });
-            section != _sectionHeaders.end())
+        if (auto section = _sections.Find(rva))
         {
-            const auto sectionHeader = *section;
-            return rva - sectionHeader->VirtualAddress + sectionHeader->PointerToRawData;
+            return rva - _sections.VirtualAddresses()[*section] + _sections.RawPointers()[*section];
         }
 
         return 0;
@@ -81,19 +232,28 @@ public:
 private:
     IMAGE_DOS_HEADER* _dosHeader{};
     IMAGE_NT_HEADERS* _ntHeader{};
-    std::vector<IMAGE_SECTION_HEADER*> _sectionHeaders{};
-    std::vector<std::uint8_t> _data{};
+    std::span<IMAGE_SECTION_HEADER> _sectionHeaders{};
+    SectionTable _sections;
+    std::pmr::vector<std::uint8_t> _data;
+    detail::Lazy<ExportIndex> _exports;
+    detail::Lazy<PageHashes> _pages;
     PEError _error{PEError::Success};
     bool _ok{false};
 
-    void Parse(std::ifstream& f)
+    void Parse(std::istream& f)
     {
-        StreamReader sr{f};
-        _data.resize(sr.Remaining());
-        sr.Read(_data);
+        StreamReader sr{f, _data.get_allocator().resource()};
+        sr.ReadToEnd(_data);
+        if (_data.size() < sizeof(IMAGE_DOS_HEADER))
+        {
+            SetError(PEError::InvalidPeFormat);
+            return;
+        }
 
         _dosHeader = reinterpret_cast<IMAGE_DOS_HEADER*>(_data.data());
-        if (_dosHeader->e_magic != IMAGE_DOS_SIGNATURE || _dosHeader->e_lfanew < sizeof(IMAGE_DOS_HEADER))
+        const auto ntHeaderOffset = static_cast<std::uint32_t>(_dosHeader->e_lfanew);
+        if (_dosHeader->e_magic != IMAGE_DOS_SIGNATURE || ntHeaderOffset < sizeof(IMAGE_DOS_HEADER) ||
+            std::size_t{ntHeaderOffset} + sizeof(IMAGE_NT_HEADERS) > _data.size())
         {
             SetError(PEError::InvalidPeFormat);
             return;
@@ -113,22 +273,127 @@ private:
             return;
         }
 
-        _sectionHeaders.reserve(_ntHeader->FileHeader.NumberOfSections);
         auto pSectionHeader = IMAGE_FIRST_SECTION(_ntHeader);
-        for (int i = 0; i < _ntHeader->FileHeader.NumberOfSections; ++i)
+        const auto sectionTableEnd = reinterpret_cast<const std::uint8_t*>(pSectionHeader) +
+                                     sizeof(IMAGE_SECTION_HEADER) * _ntHeader->FileHeader.NumberOfSections;
+        if (sectionTableEnd > _data.data() + _data.size())
         {
-            _sectionHeaders.push_back(pSectionHeader++);
+            SetError(PEError::InvalidPeFormat);
+            return;
         }
 
+        _sectionHeaders = {pSectionHeader, _ntHeader->FileHeader.NumberOfSections};
+        _sections.Build(_sectionHeaders);
+
         _ok = true;
     }
 
     constexpr IMAGE_DATA_DIRECTORY DataDirectory(int index) const noexcept
     {
-        return _ntHeader->OptionalHeader.DataDirectory[index];
+        return detail::dataDirectory(_ntHeader->OptionalHeader, index);
     }
 
     constexpr void SetError(PEError error) noexcept { _error = error; }
+
+    ExportIndex BuildExports() const
+    {
+        ExportIndex index{_data.get_allocator().resource()};
+        const auto exportDirectory = _ok ? ExportDirectory() : nullptr;
+        if (exportDirectory == nullptr)
+        {
+            return index;
+        }
+
+        const auto functions = Map<DWORD>(exportDirectory->AddressOfFunctions, exportDirectory->NumberOfFunctions);
+        const auto names = Map<DWORD>(exportDirectory->AddressOfNames, exportDirectory->NumberOfNames);
+        const auto ordinals = Map<WORD>(exportDirectory->AddressOfNameOrdinals, exportDirectory->NumberOfNames);
+        if (functions == nullptr || names == nullptr || ordinals == nullptr)
+        {
+            return index;
+        }
+
+        index.Reserve(exportDirectory->NumberOfNames);
+        for (DWORD i = 0; i < exportDirectory->NumberOfNames; ++i)
+        {
+            const auto name = MappedExtent(names[i]);
+            const auto length = std::ranges::find(name, std::uint8_t{0}) - name.begin();
+            if (ordinals[i] >= exportDirectory->NumberOfFunctions || length == std::ssize(name))
+            {
+                continue;
+            }
+
+            index.Add({{reinterpret_cast<const char*>(name.data()), static_cast<std::size_t>(length)},
+                       functions[ordinals[i]],
+                       static_cast<std::uint16_t>(exportDirectory->Base + ordinals[i])});
+        }
+
+        index.Seal();
+        return index;
+    }
+
+    // Seeds the export index from `previous` when every byte it was decoded from is unchanged and still maps to the
+    // same RVAs. The names are views into the file data, so they are rebased onto this image's copy.
+    void ReuseExports(const PE& previous, std::span<const FileRange> changed) const
+    {
+        const auto previousExports = previous._exports.Peek();
+        const auto exportDirectory = ExportDirectory();
+        const auto directory = DataDirectory(IMAGE_DIRECTORY_ENTRY_EXPORT);
+        const auto previousDirectory = previous.DataDirectory(IMAGE_DIRECTORY_ENTRY_EXPORT);
+        if (previousExports == nullptr || exportDirectory == nullptr ||
+            directory.VirtualAddress != previousDirectory.VirtualAddress || directory.Size != previousDirectory.Size ||
+            _sections != previous._sections)
+        {
+            return;
+        }
+
+        const auto unchanged = [&](std::uint32_t rva, std::size_t size) {
+            if (size == 0)
+            {
+                return true;
+            }
+
+            const auto extent = MappedExtent(rva);
+            if (extent.size() < size)
+            {
+                return false;
+            }
+
+            return not detail::overlaps(changed, extent.data() - _data.data(), size);
+        };
+
+        if (not unchanged(directory.VirtualAddress, sizeof(IMAGE_EXPORT_DIRECTORY)) ||
+            not unchanged(exportDirectory->AddressOfFunctions, exportDirectory->NumberOfFunctions * sizeof(DWORD)) ||
+            not unchanged(exportDirectory->AddressOfNames, exportDirectory->NumberOfNames * sizeof(DWORD)) ||
+            not unchanged(exportDirectory->AddressOfNameOrdinals, exportDirectory->NumberOfNames * sizeof(WORD)))
+        {
+            return;
+        }
+
+        const auto previousData = previous._data.data();
+        for (const auto& entry : previousExports->Entries())
+        {
+            if (detail::overlaps(changed, entry.name.data() - reinterpret_cast<const char*>(previousData),
+                                 entry.name.size() + 1))
+            {
+                return;
+            }
+        }
+
+        _exports.Get([&] {
+            ExportIndex index{_data.get_allocator().resource()};
+            index.Reserve(previousExports->Entries().size());
+            for (const auto& entry : previousExports->Entries())
+            {
+                const auto offset = entry.name.data() - reinterpret_cast<const char*>(previousData);
+                index.Add({{reinterpret_cast<const char*>(_data.data()) + offset, entry.name.size()},
+                           entry.rva,
+                           entry.ordinal});
+            }
+
+            index.Seal();
+            return index;
+        });
+    }
 };
 
 } // namespace Torpedo
@@ -8,6 +8,11 @@ enum class PEError
     Success = 0,
     InvalidPeFormat,
     NotSupportedMachine,
+    InvalidSection,
+    InvalidDataDirectory,
+    InvalidImportDirectory,
+    InvalidExportDirectory,
+    InvalidRelocation,
 };
 
 } // namespace Torpedo
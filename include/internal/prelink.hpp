@@ -0,0 +1,258 @@
+#pragma once
+
+#include "pe.hpp"
+#include "validator.hpp"
+
+#include <Windows.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace Torpedo
+{
+
+// On-disk cache of images that were already relocated and import-bound for one base address. A hit is mapped
+// copy-on-write straight from the cache file, so a load costs a view instead of a copy, a relocation pass and an import
+// walk. Entries are keyed by the source file's page digest and the base. An entry records every module its IAT entries
+// resolve into, forwarded-to modules included, by base, timestamp and size, and is only used while each of them is
+// still the same image at the same address.
+class PrelinkCache
+{
+public:
+    struct Mapping
+    {
+        PVOID view;
+        // one reference per import descriptor, in descriptor order; owned by the caller
+        std::pmr::vector<HMODULE> imports;
+    };
+
+    PrelinkCache(std::filesystem::path directory) : _directory{std::move(directory)} {}
+
+    [[nodiscard]] const std::filesystem::path& Directory() const noexcept { return _directory; }
+
+    [[nodiscard]] std::optional<Mapping> Map(const ValidatedPE& validated, PVOID base,
+                                             std::pmr::memory_resource* resource) const
+    {
+        const auto& pe = validated.Image();
+        const auto path = PathFor(pe, base);
+
+        Header header{};
+        std::pmr::vector<Dependency> bound{resource};
+        {
+            std::ifstream in{path, std::ios_base::in | std::ios_base::binary};
+            if (not in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != Magic ||
+                header.version != Version || header.digest != pe.Pages().Digest() ||
+                header.base != reinterpret_cast<std::uint64_t>(base) || header.imageSize != pe.ImageSize() ||
+                header.importCount != validated.ImportDescriptors().size())
+            {
+                return {};
+            }
+
+            bound.resize(header.importCount + header.targetCount);
+            if (not in.read(reinterpret_cast<char*>(bound.data()), bound.size() * sizeof(Dependency)))
+            {
+                return {};
+            }
+        }
+
+        Mapping mapping{nullptr, std::pmr::vector<HMODULE>{resource}};
+        mapping.imports.reserve(header.importCount);
+        for (std::size_t i = 0; i < header.importCount; ++i)
+        {
+            auto module = LoadLibraryA(validated.String(validated.ImportDescriptors()[i].Name).data());
+            if (module != nullptr)
+            {
+                mapping.imports.push_back(module);
+            }
+
+            // a dependency that moved (reboot, ASLR) or was updated invalidates every IAT entry bound to it
+            if (module == nullptr || Describe(module) != bound[i])
+            {
+                Release(mapping.imports);
+                return {};
+            }
+        }
+
+        // the dependencies loaded the modules they forward to, so those are already in the process
+        for (const auto& target : std::span{bound}.subspan(header.importCount))
+        {
+            HMODULE module{};
+            if (not GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                                           GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                                       reinterpret_cast<LPCWSTR>(target.base), &module) ||
+                Describe(module) != target)
+            {
+                Release(mapping.imports);
+                return {};
+            }
+        }
+
+        auto file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_EXECUTE, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            Release(mapping.imports);
+            return {};
+        }
+
+        // the view keeps the section alive, so neither handle is needed once it exists
+        auto section = CreateFileMappingW(file, nullptr, PAGE_EXECUTE_WRITECOPY, 0, 0, nullptr);
+        if (section != nullptr)
+        {
+            mapping.view = MapViewOfFileEx(section, FILE_MAP_COPY | FILE_MAP_EXECUTE, 0, ImageOffset,
+                                           pe.ImageSize(), base);
+            CloseHandle(section);
+        }
+
+        CloseHandle(file);
+        if (mapping.view == nullptr)
+        {
+            Release(mapping.imports);
+            return {};
+        }
+
+        return mapping;
+    }
+
+    // Stores `image`, which must be mapped at its final address with relocations and the IAT applied but before
+    // anything ran inside it. `imports` are the dependencies in import descriptor order.
+    bool Store(const ValidatedPE& validated, std::span<const std::uint8_t> image,
+               std::span<const HMODULE> imports) const
+    {
+        const auto& pe = validated.Image();
+        if (imports.size() != validated.ImportDescriptors().size())
+        {
+            return false;
+        }
+
+        std::vector<Dependency> dependencies;
+        for (const auto module : imports)
+        {
+            dependencies.push_back(Describe(module));
+        }
+
+        // every module an IAT entry points into; forwarded exports land outside the dependency that named them
+        std::vector<Dependency> targets;
+        for (const auto& descriptor : validated.ImportDescriptors())
+        {
+            const auto lookup = validated.At<std::uint64_t>(
+                descriptor.OriginalFirstThunk ? descriptor.OriginalFirstThunk : descriptor.FirstThunk);
+            const auto iat = reinterpret_cast<const std::uint64_t*>(image.data() + descriptor.FirstThunk);
+            for (std::size_t i = 0; lookup[i] != 0; ++i)
+            {
+                HMODULE module{};
+                if (not GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                                               GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                                           reinterpret_cast<LPCWSTR>(iat[i]), &module))
+                {
+                    return false;
+                }
+
+                if (const auto target = Describe(module); std::ranges::find(targets, target) == targets.end())
+                {
+                    targets.push_back(target);
+                }
+            }
+        }
+
+        if (sizeof(Header) + (dependencies.size() + targets.size()) * sizeof(Dependency) > ImageOffset)
+        {
+            return false;
+        }
+
+        const Header header{Magic,
+                            Version,
+                            pe.Pages().Digest(),
+                            reinterpret_cast<std::uint64_t>(image.data()),
+                            static_cast<std::uint32_t>(image.size()),
+                            static_cast<std::uint32_t>(dependencies.size()),
+                            static_cast<std::uint32_t>(targets.size())};
+
+        std::error_code ec;
+        std::filesystem::create_directories(_directory, ec);
+
+        // write under a temporary name so a concurrent Map never sees a torn entry
+        const auto path = PathFor(pe, image.data());
+        auto temporary = path;
+        temporary += ".tmp";
+        {
+            std::ofstream out{temporary, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc};
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(dependencies.data()), dependencies.size() * sizeof(Dependency));
+            out.write(reinterpret_cast<const char*>(targets.data()), targets.size() * sizeof(Dependency));
+
+            out.seekp(ImageOffset);
+            out.write(reinterpret_cast<const char*>(image.data()), image.size());
+            if (not out)
+            {
+                out.close();
+                std::filesystem::remove(temporary, ec);
+                return false;
+            }
+        }
+
+        std::filesystem::rename(temporary, path, ec);
+        return not ec;
+    }
+
+private:
+    struct Header
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint64_t digest;
+        std::uint64_t base;
+        std::uint32_t imageSize;
+        std::uint32_t importCount;
+        std::uint32_t targetCount;
+        std::uint32_t reserved;
+    };
+
+    // A module an entry was bound against. The header is followed by one per import descriptor, in descriptor order,
+    // then one per module the IAT points into.
+    struct Dependency
+    {
+        std::uint64_t base;
+        std::uint32_t timeDateStamp;
+        std::uint32_t imageSize;
+
+        friend bool operator==(const Dependency&, const Dependency&) = default;
+    };
+
+    static constexpr std::uint32_t Magic = 0x4b4c5054; // "TPLK"
+    static constexpr std::uint32_t Version = 2;
+    // views must start on an allocation-granularity boundary of the file
+    static constexpr DWORD ImageOffset = 0x10000;
+
+    std::filesystem::path _directory;
+
+    std::filesystem::path PathFor(const PE& pe, const void* base) const
+    {
+        return _directory / std::format("{:016x}-{:016x}.prelink", pe.Pages().Digest(),
+                                        reinterpret_cast<std::uintptr_t>(base));
+    }
+
+    static Dependency Describe(HMODULE module) noexcept
+    {
+        const auto ntHeader = detail::moduleHeaders(module);
+        return {reinterpret_cast<std::uint64_t>(module), ntHeader->FileHeader.TimeDateStamp,
+                ntHeader->OptionalHeader.SizeOfImage};
+    }
+
+    static void Release(std::span<const HMODULE> modules)
+    {
+        for (const auto module : modules)
+        {
+            FreeLibrary(module);
+        }
+    }
+};
+
+} // namespace Torpedo
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Torpedo
+{
+
+class Module;
+
+struct ModuleRange
+{
+    std::uintptr_t base{};
+    std::size_t size{};
+    const Module* module{};
+};
+
+class ModuleRegistry;
+
+// Keeps every module that was registered when the pin was taken mapped until the pin is dropped. Unregister, which a
+// module runs before releasing its memory, waits for the pins taken before it. Pins are meant to be short, e.g. one
+// stack walk, and a thread holding one must not unload a module.
+class RegistryPin
+{
+public:
+    RegistryPin(RegistryPin&& other) noexcept : _count{std::exchange(other._count, nullptr)} {}
+    RegistryPin(const RegistryPin&) = delete;
+    RegistryPin& operator=(const RegistryPin&) = delete;
+    ~RegistryPin()
+    {
+        if (_count)
+        {
+            _count->fetch_sub(1);
+        }
+    }
+
+private:
+    std::atomic<std::size_t>* _count;
+
+    explicit RegistryPin(std::atomic<std::size_t>* count) noexcept : _count{count} {}
+
+    friend class ModuleRegistry;
+};
+
+// Process-wide map from addresses to the modules mapped by ModuleLoader. Lookups are wait-free: they bump a reader
+// count and binary-search an immutable snapshot. Writers copy the snapshot, publish the new one and free old ones
+// once no reader is in flight, so a retired snapshot can outlive its replacement only while lookups keep overlapping.
+class ModuleRegistry
+{
+public:
+    [[nodiscard]] static ModuleRegistry& Instance()
+    {
+        static ModuleRegistry registry;
+        return registry;
+    }
+
+    ModuleRegistry(const ModuleRegistry&) = delete;
+    ~ModuleRegistry() { delete _snapshot.load(); }
+
+    [[nodiscard]] std::optional<ModuleRange> Find(const void* address) const noexcept
+    {
+        const auto target = reinterpret_cast<std::uintptr_t>(address);
+
+        _readers.fetch_add(1);
+        const auto& ranges = _snapshot.load()->ranges;
+        auto range = std::ranges::upper_bound(ranges, target, {}, &ModuleRange::base);
+
+        std::optional<ModuleRange> result;
+        if (range != ranges.begin() && target - std::prev(range)->base < std::prev(range)->size)
+        {
+            result = *std::prev(range);
+        }
+
+        _readers.fetch_sub(1);
+        return result;
+    }
+
+    [[nodiscard]] RegistryPin Pin() const noexcept
+    {
+        while (true)
+        {
+            // a pin counts in the current phase; one that raced with a phase flip retries in the new phase, so an
+            // unload only ever waits for pins that are already held
+            const auto phase = _phase.load();
+            _pins[phase].fetch_add(1);
+            if (_phase.load() == phase)
+            {
+                return RegistryPin{&_pins[phase]};
+            }
+
+            _pins[phase].fetch_sub(1);
+        }
+    }
+
+    // Changes whenever a module is registered, unregistered or moved, so a cache of lookups can tell when to drop.
+    [[nodiscard]] std::uint64_t Generation() const noexcept
+    {
+        _readers.fetch_add(1);
+        const auto generation = _snapshot.load()->generation;
+        _readers.fetch_sub(1);
+        return generation;
+    }
+
+    // Copy of every registered range, sorted by base address.
+    [[nodiscard]] std::vector<ModuleRange> Ranges() const
+    {
+        _readers.fetch_add(1);
+        auto ranges = _snapshot.load()->ranges;
+        _readers.fetch_sub(1);
+        return ranges;
+    }
+
+    void Register(const ModuleRange& range)
+    {
+        Update([&](auto& ranges) {
+            ranges.insert(std::ranges::upper_bound(ranges, range.base, {}, &ModuleRange::base), range);
+        });
+    }
+
+    // Returns once no pin taken before the module disappeared from lookups is still held, so the caller may then
+    // release the module's memory.
+    void Unregister(std::uintptr_t base)
+    {
+        Update([&](auto& ranges) {
+            std::erase_if(ranges, [base](const auto& range) { return range.base == base; });
+        });
+
+        std::scoped_lock lock{_writer};
+        const auto previous = _phase.exchange(1 - _phase.load());
+        while (_pins[previous].load() != 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // Modules are movable; the registry follows the object so lookups never return a moved-from module.
+    void Rebind(std::uintptr_t base, const Module* module)
+    {
+        Update([&](auto& ranges) {
+            for (auto& range : ranges)
+            {
+                if (range.base == base)
+                {
+                    range.module = module;
+                }
+            }
+        });
+    }
+
+private:
+    struct Snapshot
+    {
+        std::vector<ModuleRange> ranges;
+        std::uint64_t generation{};
+    };
+
+    std::atomic<const Snapshot*> _snapshot{new Snapshot{}};
+    mutable std::atomic<std::size_t> _readers{};
+    mutable std::atomic<std::size_t> _pins[2]{};
+    std::atomic<std::size_t> _phase{};
+    std::mutex _writer;
+    std::vector<std::unique_ptr<const Snapshot>> _retired;
+
+    ModuleRegistry() = default;
+
+    template<typename F> void Update(F&& modify)
+    {
+        std::scoped_lock lock{_writer};
+
+        auto next = std::make_unique<Snapshot>(*_snapshot.load());
+        modify(next->ranges);
+        ++next->generation;
+        _retired.emplace_back(_snapshot.exchange(next.release()));
+
+        // a reader that starts after the exchange can only see the new snapshot
+        if (_readers.load() == 0)
+        {
+            _retired.clear();
+        }
+    }
+};
+
+} // namespace Torpedo
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <Windows.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace Torpedo
+{
+
+// Structure-of-arrays copy of the fields that RVA lookups and per-section loops actually read. All columns live in a
+// single allocation, so a lookup over a typical image stays within a couple of cache lines instead of touching a
+// 40-byte IMAGE_SECTION_HEADER per section.
+class SectionTable
+{
+public:
+    SectionTable(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : _columns{resource} {}
+
+    void Build(std::span<const IMAGE_SECTION_HEADER> sectionHeaders)
+    {
+        _count = sectionHeaders.size();
+        _columns.resize(_count * ColumnCount);
+
+        for (std::size_t i = 0; i < _count; ++i)
+        {
+            const auto& sectionHeader = sectionHeaders[i];
+            Column(VirtualAddressColumn)[i] = sectionHeader.VirtualAddress;
+            Column(VirtualSizeColumn)[i] = sectionHeader.Misc.VirtualSize;
+            Column(RawPointerColumn)[i] = sectionHeader.PointerToRawData;
+            Column(RawSizeColumn)[i] = sectionHeader.SizeOfRawData;
+            Column(CharacteristicsColumn)[i] = sectionHeader.Characteristics;
+        }
+    }
+
+    [[nodiscard]] bool operator==(const SectionTable& other) const noexcept
+    {
+        return _count == other._count && std::ranges::equal(_columns, other._columns);
+    }
+
+    [[nodiscard]] constexpr std::size_t Size() const noexcept { return _count; }
+    [[nodiscard]] constexpr bool Empty() const noexcept { return _count == 0; }
+
+    [[nodiscard]] std::span<const std::uint32_t> VirtualAddresses() const noexcept
+    {
+        return Column(VirtualAddressColumn);
+    }
+    [[nodiscard]] std::span<const std::uint32_t> VirtualSizes() const noexcept { return Column(VirtualSizeColumn); }
+    [[nodiscard]] std::span<const std::uint32_t> RawPointers() const noexcept { return Column(RawPointerColumn); }
+    [[nodiscard]] std::span<const std::uint32_t> RawSizes() const noexcept { return Column(RawSizeColumn); }
+    [[nodiscard]] std::span<const std::uint32_t> Characteristics() const noexcept
+    {
+        return Column(CharacteristicsColumn);
+    }
+
+    // Index of the section whose [VirtualAddress, VirtualAddress + VirtualSize) contains `rva`.
+    [[nodiscard]] std::optional<std::size_t> Find(std::uint32_t rva) const noexcept
+    {
+        const auto virtualAddresses = VirtualAddresses();
+        const auto virtualSizes = VirtualSizes();
+        for (std::size_t i = 0; i < _count; ++i)
+        {
+            // unsigned wrap-around turns the two-sided range check into a single compare
+            if (rva - virtualAddresses[i] < virtualSizes[i])
+            {
+                return i;
+            }
+        }
+
+        return {};
+    }
+
+    // Same as Find, but against the part of each section that is backed by raw data.
+    [[nodiscard]] std::optional<std::size_t> FindRaw(std::uint32_t rva) const noexcept
+    {
+        const auto virtualAddresses = VirtualAddresses();
+        const auto rawSizes = RawSizes();
+        for (std::size_t i = 0; i < _count; ++i)
+        {
+            if (rva - virtualAddresses[i] < rawSizes[i])
+            {
+                return i;
+            }
+        }
+
+        return {};
+    }
+
+private:
+    enum ColumnIndex : std::size_t
+    {
+        VirtualAddressColumn,
+        VirtualSizeColumn,
+        RawPointerColumn,
+        RawSizeColumn,
+        CharacteristicsColumn,
+        ColumnCount,
+    };
+
+    std::pmr::vector<std::uint32_t> _columns;
+    std::size_t _count{};
+
+    std::span<std::uint32_t> Column(ColumnIndex column) noexcept { return {_columns.data() + column * _count, _count}; }
+    std::span<const std::uint32_t> Column(ColumnIndex column) const noexcept
+    {
+        return {_columns.data() + column * _count, _count};
+    }
+};
+
+} // namespace Torpedo
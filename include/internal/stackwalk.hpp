@@ -0,0 +1,130 @@
+#pragma once
+
+#include "loader.hpp"
+#include "registry.hpp"
+
+#include <Windows.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <span>
+
+namespace Torpedo
+{
+
+// Walks x64 stacks through both system and Torpedo-mapped frames. Mapped modules are not in the loader's module list,
+// so the OS unwinder finds no function entry for them and stops; this walker looks their frames up in the module's
+// own .pdata, found through the ModuleRegistry, and unwinds them with the same RtlVirtualUnwind.
+//
+// Each walk pins the registry, so no mapped module can be released while its frames are being unwound; a thread that
+// unloads a module must therefore not walk while it does. Lookups in mapped modules are cached by instruction pointer,
+// which a sampling profiler sees over and over. The cache is dropped whenever the registry changed since the previous
+// walk, so a cached entry only ever points into modules the current pin keeps mapped. A walker is meant to be owned by
+// one sampling thread.
+class StackWalker
+{
+public:
+    // Unwinds `context` in place and writes one instruction pointer per frame, innermost first, to `frames`. Returns
+    // the number of frames written; the walk ends at the outermost frame or when `frames` is full.
+    std::size_t Walk(CONTEXT& context, std::span<std::uintptr_t> frames) noexcept
+    {
+        const auto pin = ModuleRegistry::Instance().Pin();
+        _history = {};
+        if (const auto generation = ModuleRegistry::Instance().Generation(); generation != _generation)
+        {
+            _cache.fill({});
+            _generation = generation;
+        }
+
+        std::size_t count = 0;
+        while (count < frames.size() && context.Rip != 0 && context.Rsp != 0)
+        {
+            frames[count++] = context.Rip;
+
+            DWORD64 imageBase{};
+            if (const auto function = Lookup(context.Rip, imageBase); function != nullptr)
+            {
+                PVOID handlerData{};
+                DWORD64 establisherFrame{};
+                RtlVirtualUnwind(UNW_FLAG_NHANDLER, imageBase, context.Rip, const_cast<PRUNTIME_FUNCTION>(function),
+                                 &context, &handlerData, &establisherFrame, nullptr);
+            }
+            else
+            {
+                // a leaf function has no entry: it never moves rsp, so the return address is on top of the stack
+                context.Rip = *reinterpret_cast<const DWORD64*>(context.Rsp);
+                context.Rsp += sizeof(DWORD64);
+            }
+        }
+
+        return count;
+    }
+
+    // Walks the calling thread's stack; the first frame is Capture itself, or its caller where it was inlined.
+    std::size_t Capture(std::span<std::uintptr_t> frames) noexcept
+    {
+        CONTEXT context{};
+        RtlCaptureContext(&context);
+        return Walk(context, frames);
+    }
+
+private:
+    static constexpr std::size_t CacheSize = 1024;
+
+    struct CacheEntry
+    {
+        DWORD64 ip;
+        DWORD64 imageBase;
+        const IMAGE_RUNTIME_FUNCTION_ENTRY* function;
+    };
+
+    std::array<CacheEntry, StackWalker::CacheSize> _cache{};
+    std::uint64_t _generation{};
+    UNWIND_HISTORY_TABLE _history{};
+
+    static std::span<const IMAGE_RUNTIME_FUNCTION_ENTRY> RuntimeFunctions(std::uintptr_t base) noexcept
+    {
+        const auto image = reinterpret_cast<const std::uint8_t*>(base);
+        const auto ntHeader = detail::moduleHeaders(reinterpret_cast<HMODULE>(base));
+        const auto directory = detail::dataDirectory(ntHeader->OptionalHeader, IMAGE_DIRECTORY_ENTRY_EXCEPTION);
+        return {reinterpret_cast<const IMAGE_RUNTIME_FUNCTION_ENTRY*>(image + directory.VirtualAddress),
+                directory.Size / sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY)};
+    }
+
+    const IMAGE_RUNTIME_FUNCTION_ENTRY* Lookup(DWORD64 ip, DWORD64& imageBase) noexcept
+    {
+        auto& cached = _cache[(ip ^ ip >> 10) % CacheSize];
+        if (cached.ip == ip)
+        {
+            imageBase = cached.imageBase;
+            return cached.function;
+        }
+
+        const auto range = ModuleRegistry::Instance().Find(reinterpret_cast<const void*>(ip));
+        if (not range)
+        {
+            // system modules can be unloaded behind the registry's back, so their lookups are not cached past the
+            // current walk; the history table RtlLookupFunctionEntry fills in is reset at the start of each one
+            return RtlLookupFunctionEntry(ip, &imageBase, &_history);
+        }
+
+        // .pdata is sorted by BeginAddress and its entries do not overlap. It is found through the image's own headers
+        // because range->module may be a Module that a concurrent move has just destroyed.
+        imageBase = range->base;
+        const auto rva = static_cast<DWORD>(ip - range->base);
+        const auto functions = RuntimeFunctions(range->base);
+        const auto next = std::ranges::upper_bound(functions, rva, {}, &IMAGE_RUNTIME_FUNCTION_ENTRY::BeginAddress);
+        const IMAGE_RUNTIME_FUNCTION_ENTRY* function = nullptr;
+        if (next != functions.begin() && rva < std::prev(next)->EndAddress)
+        {
+            function = &*std::prev(next);
+        }
+
+        cached = {ip, imageBase, function};
+        return function;
+    }
+};
+
+} // namespace Torpedo
@@ -1,41 +1,224 @@
 #pragma once
 
+#include "boundspolicy.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory_resource>
+#include <optional>
 #include <span>
+#include <type_traits>
+#include <vector>
 
 namespace Torpedo
 {
 
-template<typename T> class StreamReader
+// Buffered reader over any std::istream. It never seeks, so pipes, stdin and decompressor streams work as well as
+// files; the only cost of not knowing the size up front is that ReadToEnd grows its output as data arrives. Refills
+// take what the stream already holds and otherwise wait for the next byte, so a read from a pipe never blocks for more
+// data than it needs.
+template<typename T, BoundsPolicy Policy = CheckedPolicy> class StreamReader
 {
 public:
-    constexpr StreamReader(T& stream) noexcept : _stream{stream}
+    static constexpr std::size_t BufferSize = 1 << 20;
+    static constexpr std::size_t BufferAlignment = 64;
+    // first step when ReadToEnd has to grow an empty container; a small image read from a pipe stays small
+    static constexpr std::size_t MinimumGrowth = 1 << 16;
+
+    StreamReader(T& stream, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+        : _stream{stream}, _resource{resource}
     {
-        _stream.seekg(0, std::ios_base::end);
-        _size = _stream.tellg();
-        _stream.seekg(0);
     }
     StreamReader(StreamReader&) = delete;
+    ~StreamReader()
+    {
+        if (_buffer)
+        {
+            _resource->deallocate(_buffer, BufferSize, BufferAlignment);
+        }
+    }
 
-    template<typename U> auto& operator>>(U& target)
+    template<typename U>
+    requires std::is_trivially_copyable_v<U>
+    auto& operator>>(U& target)
     {
-        _stream.read(reinterpret_cast<char*>(&target), sizeof(U));
+        if (Verify(Fill(sizeof(U), 1)))
+        {
+            std::memcpy(&target, &_buffer[_begin], sizeof(U));
+            Consume(sizeof(U));
+        }
+
         return *this;
     }
 
+    template<typename U>
+    requires std::is_trivially_copyable_v<U>
+    [[nodiscard]] std::optional<U> Peek()
+    {
+        if (not Fill(sizeof(U), 1))
+        {
+            return {};
+        }
+
+        U value;
+        std::memcpy(&value, &_buffer[_begin], sizeof(U));
+        return value;
+    }
+
+    // The returned span points into the internal buffer and stays valid until the next call on this reader.
+    template<typename U>
+    requires std::is_trivially_copyable_v<U>
+    [[nodiscard]] std::span<const U> ReadSpan(std::size_t count)
+    {
+        const auto bytes = count * sizeof(U);
+        if (not Verify(bytes <= BufferSize && Fill(bytes, alignof(U))))
+        {
+            return {};
+        }
+
+        const auto data = reinterpret_cast<const U*>(&_buffer[_begin]);
+        Consume(bytes);
+        return {data, count};
+    }
+
     auto& Read(std::span<std::uint8_t> buffer)
     {
-        _stream.read(reinterpret_cast<char*>(buffer.data()), buffer.size_bytes());
+        const auto buffered = std::min(buffer.size_bytes(), _end - _begin);
+        if (buffered != 0)
+        {
+            std::memcpy(buffer.data(), &_buffer[_begin], buffered);
+            Consume(buffered);
+        }
+
+        // large reads go straight to the destination instead of bouncing through the buffer
+        const auto rest = buffer.subspan(buffered);
+        _stream.read(reinterpret_cast<char*>(rest.data()), rest.size_bytes());
+        _pos += _stream.gcount();
+        Verify(static_cast<std::size_t>(_stream.gcount()) == rest.size_bytes());
+
         return *this;
     }
 
-    constexpr void Seek(std::uint64_t pos) { _stream.seekg(pos); }
-    constexpr auto Pos() const noexcept { return _stream.tellg(); }
-    constexpr auto Remaining() const noexcept { return _size - Pos(); }
+    template<typename Container> auto& ReadToEnd(Container& out)
+    {
+        auto size = out.size();
+        if (const auto buffered = _end - _begin; buffered != 0)
+        {
+            out.resize(size + buffered);
+            std::memcpy(out.data() + size, &_buffer[_begin], buffered);
+            Consume(buffered);
+            size += buffered;
+        }
+
+        while (_stream)
+        {
+            // fill whatever the caller reserved before growing, so a stream of known size is read with no reallocation
+            if (out.capacity() == size && _stream.peek() == T::traits_type::eof())
+            {
+                break;
+            }
+
+            out.resize(out.capacity() > size ? out.capacity() : std::max(MinimumGrowth, size * 2));
+            const auto count = ReadAvailable(reinterpret_cast<std::uint8_t*>(out.data() + size), out.size() - size);
+            size += count;
+            _pos += count;
+        }
+
+        out.resize(size);
+        return *this;
+    }
+
+    void Skip(std::size_t size)
+    {
+        while (size != 0 && Fill(1, 1))
+        {
+            const auto step = std::min(size, _end - _begin);
+            Consume(step);
+            size -= step;
+        }
+
+        Verify(size == 0);
+    }
+
+    [[nodiscard]] constexpr std::uint64_t Pos() const noexcept { return _pos; }
+    [[nodiscard]] bool Eof() { return not Fill(1, 1); }
+    [[nodiscard]] constexpr bool Overflowed() const noexcept { return _overflowed; }
 
 private:
     T& _stream;
-    std::size_t _size;
+    std::pmr::memory_resource* _resource;
+    std::uint8_t* _buffer{};
+    std::size_t _begin{};
+    std::size_t _end{};
+    std::uint64_t _pos{};
+    bool _overflowed{false};
+
+    constexpr bool Verify(bool inBounds) noexcept
+    {
+        if (Policy::Verify(inBounds))
+        {
+            return true;
+        }
+
+        _overflowed = true;
+        return false;
+    }
+
+    constexpr void Consume(std::size_t size) noexcept
+    {
+        _begin += size;
+        _pos += size;
+    }
+
+    // Makes at least `size` bytes available at an `alignment`-aligned offset of the buffer.
+    bool Fill(std::size_t size, std::size_t alignment)
+    {
+        if (_end - _begin >= size && _begin % alignment == 0)
+        {
+            return true;
+        }
+
+        if (size > BufferSize)
+        {
+            return false;
+        }
+
+        // whole-stream reads never touch the buffer, so it is only allocated once something actually needs it
+        if (_buffer == nullptr)
+        {
+            _buffer = static_cast<std::uint8_t*>(_resource->allocate(BufferSize, BufferAlignment));
+        }
+
+        if (_begin % alignment != 0 || BufferSize - _begin < size)
+        {
+            std::memmove(&_buffer[0], &_buffer[_begin], _end - _begin);
+            _end -= _begin;
+            _begin = 0;
+        }
+
+        while (_end - _begin < size && _stream)
+        {
+            _end += ReadAvailable(&_buffer[_end], BufferSize - _end);
+        }
+
+        return _end - _begin >= size;
+    }
+
+    // Reads up to `size` bytes the stream already holds. When it holds none, waits for at least one byte or the end
+    // of the stream rather than for all `size` bytes.
+    std::size_t ReadAvailable(std::uint8_t* out, std::size_t size)
+    {
+        auto count = _stream.readsome(reinterpret_cast<char*>(out), static_cast<std::streamsize>(size));
+        if (count == 0 && _stream.peek() != T::traits_type::eof())
+        {
+            count = _stream.readsome(reinterpret_cast<char*>(out), static_cast<std::streamsize>(size));
+        }
+
+        return static_cast<std::size_t>(count);
+    }
 };
 
 } // namespace Torpedo
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "loader.hpp"
+#include "registry.hpp"
+
+#include <Windows.h>
+#include <algorithm>
+#include <cstdint>
+#include <memory_resource>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Torpedo
+{
+
+struct Symbol
+{
+    const Module* module{};
+    std::uintptr_t moduleBase{};
+    std::optional<std::size_t> section{};
+    std::string_view name{};
+    std::optional<std::uint32_t> functionRva{};
+    std::uint32_t offset{};
+};
+
+// Function starts of one mapped module, taken from its export directory and its .pdata, sorted by RVA. Exported
+// names win over anonymous .pdata entries at the same address.
+class SymbolTable
+{
+public:
+    SymbolTable(const Module& module, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : _rvas{resource}, _names{resource}
+    {
+        std::pmr::vector<std::pair<std::uint32_t, std::string_view>> symbols{resource};
+        AddExports(module, symbols);
+        for (const auto& runtimeFunction : module.RuntimeFunctions())
+        {
+            symbols.emplace_back(runtimeFunction.BeginAddress, std::string_view{});
+        }
+
+        // named entries sort before anonymous ones at the same RVA, so unique keeps the name
+        std::ranges::sort(symbols, [](const auto& lhs, const auto& rhs) {
+            return lhs.first != rhs.first ? lhs.first < rhs.first : lhs.second.size() > rhs.second.size();
+        });
+        const auto [end, _] = std::ranges::unique(symbols, {}, &std::pair<std::uint32_t, std::string_view>::first);
+        symbols.erase(end, symbols.end());
+
+        _rvas.reserve(symbols.size());
+        _names.reserve(symbols.size());
+        for (const auto& [rva, name] : symbols)
+        {
+            _rvas.push_back(rva);
+            _names.push_back(name);
+        }
+    }
+
+    [[nodiscard]] std::span<const std::uint32_t> Rvas() const noexcept { return _rvas; }
+    [[nodiscard]] std::span<const std::string_view> Names() const noexcept { return _names; }
+
+private:
+    std::pmr::vector<std::uint32_t> _rvas;
+    std::pmr::vector<std::string_view> _names;
+
+    static void AddExports(const Module& module, auto& symbols)
+    {
+        const auto exportDirectory = module.ExportDirectory();
+        if (exportDirectory == nullptr)
+        {
+            return;
+        }
+
+        const auto base = module.Data().data();
+        const auto functions = reinterpret_cast<const DWORD*>(base + exportDirectory->AddressOfFunctions);
+        const auto names = reinterpret_cast<const DWORD*>(base + exportDirectory->AddressOfNames);
+        const auto ordinals = reinterpret_cast<const WORD*>(base + exportDirectory->AddressOfNameOrdinals);
+        const auto directory = detail::dataDirectory(module.NtHeader()->OptionalHeader, IMAGE_DIRECTORY_ENTRY_EXPORT);
+
+        for (DWORD i = 0; i < exportDirectory->NumberOfNames; ++i)
+        {
+            // forwarders point at a string inside the export directory, not at code
+            const auto rva = functions[ordinals[i]];
+            if (not detail::inBetween(rva, directory.VirtualAddress, directory.VirtualAddress + directory.Size))
+            {
+                symbols.emplace_back(rva, reinterpret_cast<const char*>(base + names[i]));
+            }
+        }
+    }
+};
+
+// Resolves large batches of addresses to (module, section, nearest function, offset). The addresses are sorted once
+// and merged against the modules, the section table and the per-module symbol arrays, so each of those is walked
+// front to back instead of being searched per address.
+class Symbolizer
+{
+public:
+    Symbolizer(std::span<const Module* const> modules,
+               std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : _modules{resource}, _resource{resource}
+    {
+        _modules.reserve(modules.size());
+        for (const auto module : modules)
+        {
+            _modules.push_back({reinterpret_cast<std::uintptr_t>(module->ImageBase()), module->ImageSize(), module,
+                                SymbolTable{*module, resource}});
+        }
+
+        std::ranges::sort(_modules, {}, &ModuleSymbols::base);
+    }
+
+    // Snapshot of every module currently mapped by ModuleLoader. The modules must outlive the symbolizer.
+    [[nodiscard]] static Symbolizer FromRegistry(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    {
+        std::pmr::vector<const Module*> modules{resource};
+        for (const auto& range : ModuleRegistry::Instance().Ranges())
+        {
+            modules.push_back(range.module);
+        }
+
+        return Symbolizer{modules, resource};
+    }
+
+    [[nodiscard]] std::pmr::vector<Symbol> Symbolize(std::span<const std::uintptr_t> addresses) const
+    {
+        std::pmr::vector<Symbol> symbols(addresses.size(), _resource);
+
+        std::pmr::vector<std::uint32_t> order(addresses.size(), _resource);
+        std::iota(order.begin(), order.end(), 0);
+        if (not std::ranges::is_sorted(addresses))
+        {
+            std::ranges::sort(order, {}, [addresses](auto i) { return addresses[i]; });
+        }
+
+        std::size_t module{};
+        std::size_t section{};
+        std::size_t symbol{};
+        for (const auto i : order)
+        {
+            const auto address = addresses[i];
+            while (module < _modules.size() && address - _modules[module].base >= _modules[module].size &&
+                   address >= _modules[module].base)
+            {
+                ++module;
+                section = 0;
+                symbol = 0;
+            }
+
+            if (module == _modules.size() || address < _modules[module].base)
+            {
+                continue;
+            }
+
+            const auto& entry = _modules[module];
+            const auto rva = static_cast<std::uint32_t>(address - entry.base);
+            auto& result = symbols[i];
+            result.module = entry.module;
+            result.moduleBase = entry.base;
+
+            const auto& sections = entry.module->Sections();
+            const auto virtualAddresses = sections.VirtualAddresses();
+            while (section + 1 < sections.Size() && virtualAddresses[section + 1] <= rva)
+            {
+                ++section;
+            }
+
+            if (not sections.Empty() && rva - virtualAddresses[section] < sections.VirtualSizes()[section])
+            {
+                result.section = section;
+            }
+
+            const auto rvas = entry.symbols.Rvas();
+            while (symbol + 1 < rvas.size() && rvas[symbol + 1] <= rva)
+            {
+                ++symbol;
+            }
+
+            if (not rvas.empty() && rvas[symbol] <= rva)
+            {
+                result.name = entry.symbols.Names()[symbol];
+                result.functionRva = rvas[symbol];
+                result.offset = rva - rvas[symbol];
+            }
+            else
+            {
+                result.offset = rva;
+            }
+        }
+
+        return symbols;
+    }
+
+private:
+    struct ModuleSymbols
+    {
+        std::uintptr_t base;
+        std::size_t size;
+        const Module* module;
+        SymbolTable symbols;
+    };
+
+    std::pmr::vector<ModuleSymbols> _modules;
+    std::pmr::memory_resource* _resource;
+};
+
+} // namespace Torpedo
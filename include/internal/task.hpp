@@ -0,0 +1,137 @@
+#pragma once
+
+#include <Windows.h>
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace Torpedo
+{
+
+// Anything that can resume a coroutine on a thread of the caller's choosing, e.g. a reactor's run queue.
+template<typename T>
+concept Executor = requires(T& executor, std::coroutine_handle<> handle) { executor.Post(handle); };
+
+// Lazily started coroutine result. Awaiting it starts the body and resumes the awaiter when the body finishes.
+template<typename T> class Task
+{
+public:
+    struct promise_type
+    {
+        std::optional<T> value{};
+        std::coroutine_handle<> continuation{std::noop_coroutine()};
+
+        Task get_return_object() noexcept { return Task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        auto final_suspend() noexcept
+        {
+            struct FinalAwaiter
+            {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    return handle.promise().continuation;
+                }
+                void await_resume() noexcept {}
+            };
+
+            return FinalAwaiter{};
+        }
+
+        void return_value(T result) { value.emplace(std::move(result)); }
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    Task(Task&& other) noexcept : _handle{std::exchange(other._handle, nullptr)} {}
+    Task(const Task&) = delete;
+    ~Task()
+    {
+        if (_handle)
+        {
+            _handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        _handle.promise().continuation = continuation;
+        return _handle;
+    }
+    T await_resume() { return std::move(*_handle.promise().value); }
+
+private:
+    std::coroutine_handle<promise_type> _handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept : _handle{handle} {}
+};
+
+namespace detail
+{
+
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// Runs blocking work on the system thread pool and resumes the awaiting coroutine through the executor, so the
+// executor's threads never block on file reads or LoadLibrary.
+template<typename E, typename F> class Offload
+{
+public:
+    Offload(E& executor, F work) : _executor{executor}, _work{std::move(work)} {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        _continuation = continuation;
+        if (TrySubmitThreadpoolCallback(&Offload::Run, this, nullptr))
+        {
+            return true;
+        }
+
+        // no pool available; doing the work inline is still correct, just blocking
+        _result.emplace(_work());
+        return false;
+    }
+
+    auto await_resume() { return std::move(*_result); }
+
+private:
+    E& _executor;
+    F _work;
+    std::optional<std::invoke_result_t<F&>> _result{};
+    std::coroutine_handle<> _continuation{};
+
+    static void CALLBACK Run(PTP_CALLBACK_INSTANCE, PVOID context)
+    {
+        auto self = static_cast<Offload*>(context);
+        self->_result.emplace(self->_work());
+
+        // the coroutine may resume and destroy this awaiter as soon as it is posted, so touch nothing afterwards
+        auto& executor = self->_executor;
+        executor.Post(self->_continuation);
+    }
+};
+
+} // namespace detail
+
+// Starts a task from non-coroutine code and hands its result to `onDone` on whichever thread finishes it.
+template<typename T, std::invocable<T> F> void Spawn(Task<T> task, F onDone)
+{
+    [](Task<T> task, F onDone) -> detail::Detached { onDone(co_await task); }(std::move(task), std::move(onDone));
+}
+
+} // namespace Torpedo
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "ndjson.hpp"
+
+#include <Windows.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace Torpedo
+{
+
+enum class TracePhase : char
+{
+    Begin = 'B',
+    End = 'E',
+};
+
+// One cache line per event. `category` and `name` must be string literals; `detail`, e.g. a file or library name, is
+// copied and truncated to fit.
+struct TraceEvent
+{
+    std::int64_t timestamp;
+    const char* category;
+    const char* name;
+    TracePhase phase;
+    char detail[39];
+};
+
+// Single-producer, single-consumer ring owned by one thread. The owner pushes and Tracer::Flush drains. A full ring
+// drops new events and counts them, so a slow flush never stalls the thread being traced.
+class TraceRing
+{
+public:
+    static constexpr std::size_t Capacity = 4096;
+
+    TraceRing(std::uint32_t thread) noexcept : _thread{thread} {}
+
+    void Push(const TraceEvent& event) noexcept
+    {
+        const auto head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) == Capacity)
+        {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        _events[head % Capacity] = event;
+        _head.store(head + 1, std::memory_order_release);
+    }
+
+    template<typename F> void Drain(F&& f)
+    {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        for (const auto head = _head.load(std::memory_order_acquire); tail != head; ++tail)
+        {
+            f(_events[tail % Capacity]);
+        }
+
+        _tail.store(tail, std::memory_order_release);
+    }
+
+    [[nodiscard]] constexpr std::uint32_t Thread() const noexcept { return _thread; }
+    [[nodiscard]] std::uint64_t TakeDropped() noexcept { return _dropped.exchange(0, std::memory_order_relaxed); }
+
+private:
+    std::array<TraceEvent, TraceRing::Capacity> _events;
+    alignas(64) std::atomic<std::uint64_t> _head{};
+    alignas(64) std::atomic<std::uint64_t> _tail{};
+    std::atomic<std::uint64_t> _dropped{};
+    std::uint32_t _thread;
+};
+
+// Process-wide trace recorder. Each thread records into its own ring, so recording takes no lock and touches no shared
+// cache line; the mutex is only taken the first time a thread records and while flushing. With tracing disabled a
+// TraceScope costs one relaxed load.
+class Tracer
+{
+public:
+    [[nodiscard]] static Tracer& Instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    Tracer(const Tracer&) = delete;
+
+    void Enable() noexcept { _enabled.store(true, std::memory_order_relaxed); }
+    void Disable() noexcept { _enabled.store(false, std::memory_order_relaxed); }
+    [[nodiscard]] bool Enabled() const noexcept { return _enabled.load(std::memory_order_relaxed); }
+
+    void Record(TracePhase phase, const char* category, const char* name, std::string_view detail = {})
+    {
+        LARGE_INTEGER now{};
+        QueryPerformanceCounter(&now);
+
+        TraceEvent event{now.QuadPart, category, name, phase, {}};
+        detail = detail.substr(0, sizeof(event.detail) - 1);
+        std::copy(detail.begin(), detail.end(), event.detail);
+        Ring().Push(event);
+    }
+
+    // Drains every thread's ring into `out` as Chrome trace-event JSON, one object per line, each followed by a comma.
+    // The trace viewer accepts an array with no closing bracket, so a file that starts with "[" can be appended to for
+    // as long as the process runs.
+    template<typename Out> Out Flush(Out out)
+    {
+        std::scoped_lock lock{_mutex};
+        const auto pid = GetCurrentProcessId();
+        for (const auto& ring : _rings)
+        {
+            ring->Drain([&](const TraceEvent& event) {
+                out = std::format_to(out,
+                                     "{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"{}\",\"ts\":{},\"pid\":{},\"tid\":{}",
+                                     event.name, event.category, event.phase == TracePhase::Begin ? "B" : "E",
+                                     Microseconds(event.timestamp), pid, ring->Thread());
+                if (event.detail[0] != '\0')
+                {
+                    out = std::format_to(out, ",\"args\":{{\"detail\":{}}}", detail::JsonString{event.detail});
+                }
+
+                out = std::format_to(out, "}},\n");
+            });
+
+            if (const auto dropped = ring->TakeDropped(); dropped != 0)
+            {
+                LARGE_INTEGER now{};
+                QueryPerformanceCounter(&now);
+                out = std::format_to(out,
+                                     "{{\"name\":\"dropped\",\"ph\":\"i\",\"s\":\"t\",\"ts\":{},\"pid\":{},\"tid\":{},"
+                                     "\"args\":{{\"events\":{}}}}},\n",
+                                     Microseconds(now.QuadPart), pid, ring->Thread(), dropped);
+            }
+        }
+
+        return out;
+    }
+
+private:
+    std::atomic<bool> _enabled{};
+    std::int64_t _frequency{};
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<TraceRing>> _rings;
+
+    Tracer()
+    {
+        LARGE_INTEGER frequency{};
+        QueryPerformanceFrequency(&frequency);
+        _frequency = frequency.QuadPart;
+    }
+
+    // a thread's ring stays registered after the thread exits; pool threads are reused, so their number stays small
+    TraceRing& Ring()
+    {
+        thread_local TraceRing* ring = nullptr;
+        if (ring == nullptr)
+        {
+            std::scoped_lock lock{_mutex};
+            ring = _rings.emplace_back(std::make_unique<TraceRing>(GetCurrentThreadId())).get();
+        }
+
+        return *ring;
+    }
+
+    [[nodiscard]] std::int64_t Microseconds(std::int64_t ticks) const noexcept
+    {
+        // split to keep ticks * 1'000'000 from overflowing on long uptimes
+        return ticks / _frequency * 1'000'000 + ticks % _frequency * 1'000'000 / _frequency;
+    }
+};
+
+// Records a begin event when constructed and the matching end event when destroyed.
+class TraceScope
+{
+public:
+    TraceScope(const char* category, const char* name, std::string_view detail = {})
+        : _category{category}, _name{name}, _active{Tracer::Instance().Enabled()}
+    {
+        if (_active)
+        {
+            Tracer::Instance().Record(TracePhase::Begin, _category, _name, detail);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    ~TraceScope()
+    {
+        if (_active)
+        {
+            Tracer::Instance().Record(TracePhase::End, _category, _name);
+        }
+    }
+
+private:
+    const char* _category;
+    const char* _name;
+    bool _active;
+};
+
+} // namespace Torpedo
@@ -0,0 +1,572 @@
+#pragma once
+
+#include "pe.hpp"
+#include "peerror.hpp"
+
+#include <Windows.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+
+namespace Torpedo
+{
+
+namespace detail
+{
+
+// Counterpart of PE::Map for images that already went through Validate: the size was checked there, so only the
+// section lookup remains. Every RVA the validator let through is backed by file data.
+inline std::optional<std::size_t> rawOffset(const PE& pe, std::uint32_t rva) noexcept
+{
+    if (rva < pe.NtHeader()->OptionalHeader.SizeOfHeaders)
+    {
+        return rva;
+    }
+
+    const auto& sections = pe.Sections();
+    const auto section = sections.FindRaw(rva);
+    if (not section)
+    {
+        return {};
+    }
+
+    return rva - sections.VirtualAddresses()[*section] + sections.RawPointers()[*section];
+}
+
+// module names compare case-insensitively; only ASCII letters fold, as in the names the linker writes
+constexpr char asciiLower(char c) noexcept
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+} // namespace detail
+
+// One entry of the bound import directory: the timestamp a dependency had when the image was bound against it, and
+// the modules that dependency forwarded some of the bound exports to.
+struct BoundImport
+{
+    DWORD timeDateStamp;
+    std::string_view name;
+    std::span<const IMAGE_BOUND_FORWARDER_REF> forwarders;
+};
+
+// Proof that a PE went through Validate. Only the validator can create one, and its accessors skip every bounds check
+// because the validator already did them.
+class ValidatedPE
+{
+public:
+    [[nodiscard]] constexpr const PE& Image() const noexcept { return *_pe; }
+
+    // nullptr only for an RVA the validator never checked, which is a caller bug
+    template<typename T> [[nodiscard]] const T* At(std::uint32_t rva) const noexcept
+    {
+        const auto offset = detail::rawOffset(*_pe, rva);
+        return offset ? reinterpret_cast<const T*>(_pe->Data().data() + *offset) : nullptr;
+    }
+
+    [[nodiscard]] std::string_view String(std::uint32_t rva) const noexcept
+    {
+        const auto string = At<char>(rva);
+        return string ? std::string_view{string} : std::string_view{};
+    }
+
+    [[nodiscard]] std::span<const IMAGE_IMPORT_DESCRIPTOR> ImportDescriptors() const noexcept
+    {
+        if (_importCount == 0)
+        {
+            return {};
+        }
+
+        return {At<IMAGE_IMPORT_DESCRIPTOR>(Directory(IMAGE_DIRECTORY_ENTRY_IMPORT).VirtualAddress), _importCount};
+    }
+
+    [[nodiscard]] const IMAGE_EXPORT_DIRECTORY* ExportDirectory() const noexcept
+    {
+        const auto directory = Directory(IMAGE_DIRECTORY_ENTRY_EXPORT);
+        return directory.Size ? At<IMAGE_EXPORT_DIRECTORY>(directory.VirtualAddress) : nullptr;
+    }
+
+    [[nodiscard]] std::span<const IMAGE_RUNTIME_FUNCTION_ENTRY> RuntimeFunctions() const noexcept
+    {
+        const auto directory = Directory(IMAGE_DIRECTORY_ENTRY_EXCEPTION);
+        if (directory.Size == 0)
+        {
+            return {};
+        }
+
+        return {At<IMAGE_RUNTIME_FUNCTION_ENTRY>(directory.VirtualAddress),
+                directory.Size / sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY)};
+    }
+
+    // The bound import directory entry for `dll`, compared case-insensitively. A directory that failed validation is
+    // treated as absent, as the OS loader does, so imports then resolve by name.
+    [[nodiscard]] std::optional<BoundImport> FindBoundImport(std::string_view dll) const noexcept
+    {
+        if (not _boundImports)
+        {
+            return {};
+        }
+
+        const auto directory = Directory(IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT);
+        auto entry = At<IMAGE_BOUND_IMPORT_DESCRIPTOR>(directory.VirtualAddress);
+        while (entry->TimeDateStamp != 0 || entry->OffsetModuleName != 0)
+        {
+            const auto forwarders = reinterpret_cast<const IMAGE_BOUND_FORWARDER_REF*>(entry + 1);
+            const BoundImport bound{entry->TimeDateStamp, BoundImportName(entry->OffsetModuleName),
+                                    {forwarders, entry->NumberOfModuleForwarderRefs}};
+            if (std::ranges::equal(bound.name, dll, {}, detail::asciiLower, detail::asciiLower))
+            {
+                return bound;
+            }
+
+            entry = reinterpret_cast<const IMAGE_BOUND_IMPORT_DESCRIPTOR*>(forwarders + bound.forwarders.size());
+        }
+
+        return {};
+    }
+
+    // Names in the bound import directory are offsets from its start.
+    [[nodiscard]] std::string_view BoundImportName(WORD offset) const noexcept
+    {
+        return At<char>(Directory(IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT).VirtualAddress + offset);
+    }
+
+    // Calls f(rva, type) for every relocation entry except IMAGE_REL_BASED_ABSOLUTE padding.
+    template<typename F> void ForEachRelocation(F&& f) const
+    {
+        const auto directory = Directory(IMAGE_DIRECTORY_ENTRY_BASERELOC);
+        if (directory.Size == 0)
+        {
+            return;
+        }
+
+        auto block = At<std::uint8_t>(directory.VirtualAddress);
+        const auto end = block + directory.Size;
+        while (block < end)
+        {
+            const auto header = reinterpret_cast<const IMAGE_BASE_RELOCATION*>(block);
+            const auto entries = reinterpret_cast<const WORD*>(header + 1);
+            const auto count = (header->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(WORD);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (const auto type = entries[i] >> 12; type != IMAGE_REL_BASED_ABSOLUTE)
+                {
+                    f(static_cast<std::uint32_t>(header->VirtualAddress + (entries[i] & 0xfff)), type);
+                }
+            }
+
+            block += header->SizeOfBlock;
+        }
+    }
+
+private:
+    const PE* _pe;
+    std::size_t _importCount;
+    bool _boundImports;
+
+    constexpr ValidatedPE(const PE& pe, std::size_t importCount, bool boundImports) noexcept
+        : _pe{&pe}, _importCount{importCount}, _boundImports{boundImports}
+    {
+    }
+
+    IMAGE_DATA_DIRECTORY Directory(int index) const noexcept
+    {
+        return detail::dataDirectory(_pe->NtHeader()->OptionalHeader, index);
+    }
+
+    friend std::optional<ValidatedPE> Validate(const PE& pe, PEError& error) noexcept;
+};
+
+namespace detail
+{
+
+class Validation
+{
+public:
+    constexpr Validation(const PE& pe) noexcept : _pe{pe}, _optionalHeader{pe.NtHeader()->OptionalHeader} {}
+
+    PEError Run() noexcept
+    {
+        for (auto step : {&Validation::Headers, &Validation::Sections, &Validation::DataDirectories, &Validation::Imports,
+                          &Validation::Exports, &Validation::Relocations, &Validation::Exceptions})
+        {
+            if (auto error = (this->*step)(); error != PEError::Success)
+            {
+                return error;
+            }
+        }
+
+        return PEError::Success;
+    }
+
+    [[nodiscard]] constexpr std::size_t ImportCount() const noexcept { return _importCount; }
+
+    // Binding is only an optimisation the OS loader drops when the directory is malformed, so a bad one does not fail
+    // validation; it is reported here and ignored.
+    [[nodiscard]] bool BoundImportsValid() const noexcept
+    {
+        const auto directory = Directory(IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT);
+        if (directory.Size == 0 ||
+            std::uint64_t{directory.VirtualAddress} + directory.Size > _optionalHeader.SizeOfHeaders)
+        {
+            return false;
+        }
+
+        // the directory lives in the headers, where file offsets and RVAs coincide
+        const auto bytes = _pe.Data().subspan(directory.VirtualAddress, directory.Size);
+        const auto named = [&bytes](WORD offset) {
+            return offset < bytes.size() && std::memchr(bytes.data() + offset, 0, bytes.size() - offset) != nullptr;
+        };
+
+        for (std::size_t offset = 0; offset + sizeof(IMAGE_BOUND_IMPORT_DESCRIPTOR) <= bytes.size();)
+        {
+            IMAGE_BOUND_IMPORT_DESCRIPTOR entry;
+            std::memcpy(&entry, bytes.data() + offset, sizeof(entry));
+            if (entry.TimeDateStamp == 0 && entry.OffsetModuleName == 0)
+            {
+                return true;
+            }
+
+            offset += sizeof(entry);
+            if (not named(entry.OffsetModuleName) ||
+                offset + entry.NumberOfModuleForwarderRefs * sizeof(IMAGE_BOUND_FORWARDER_REF) > bytes.size())
+            {
+                return false;
+            }
+
+            for (WORD i = 0; i < entry.NumberOfModuleForwarderRefs; ++i, offset += sizeof(IMAGE_BOUND_FORWARDER_REF))
+            {
+                IMAGE_BOUND_FORWARDER_REF forwarder;
+                std::memcpy(&forwarder, bytes.data() + offset, sizeof(forwarder));
+                if (not named(forwarder.OffsetModuleName))
+                {
+                    return false;
+                }
+            }
+        }
+
+        // no terminating entry
+        return false;
+    }
+
+private:
+    // compilers chain unwind info one or two links deep; a longer chain is malformed or loops
+    static constexpr int MaximumUnwindChain = 32;
+
+    const PE& _pe;
+    const IMAGE_OPTIONAL_HEADER64& _optionalHeader;
+    std::size_t _importCount{};
+
+    IMAGE_DATA_DIRECTORY Directory(int index) const noexcept
+    {
+        return detail::dataDirectory(_optionalHeader, index);
+    }
+
+    bool StringInFile(std::uint32_t rva) const noexcept
+    {
+        const auto extent = _pe.MappedExtent(rva);
+        return std::memchr(extent.data(), 0, extent.size()) != nullptr;
+    }
+
+    PEError Headers() noexcept
+    {
+        const auto& fileHeader = _pe.NtHeader()->FileHeader;
+        if (_optionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR64_MAGIC ||
+            _optionalHeader.NumberOfRvaAndSizes > IMAGE_NUMBEROF_DIRECTORY_ENTRIES ||
+            fileHeader.SizeOfOptionalHeader < offsetof(IMAGE_OPTIONAL_HEADER64, DataDirectory) +
+                                                  _optionalHeader.NumberOfRvaAndSizes * sizeof(IMAGE_DATA_DIRECTORY) ||
+            fileHeader.NumberOfSections == 0)
+        {
+            return PEError::InvalidPeFormat;
+        }
+
+        const auto sectionHeaders = _pe.SectionHeaders();
+        const auto sectionTableEnd =
+            reinterpret_cast<const std::uint8_t*>(sectionHeaders.data() + sectionHeaders.size()) - _pe.Data().data();
+        if (_optionalHeader.SizeOfHeaders > _optionalHeader.SizeOfImage ||
+            _optionalHeader.SizeOfHeaders > _pe.Data().size() ||
+            static_cast<std::size_t>(sectionTableEnd) > _optionalHeader.SizeOfHeaders)
+        {
+            return PEError::InvalidPeFormat;
+        }
+
+        return PEError::Success;
+    }
+
+    PEError Sections() noexcept
+    {
+        std::uint64_t previousEnd = _optionalHeader.SizeOfHeaders;
+        const auto& sections = _pe.Sections();
+        for (std::size_t i = 0; i < sections.Size(); ++i)
+        {
+            const auto virtualAddress = std::uint64_t{sections.VirtualAddresses()[i]};
+            const auto rawEnd = std::uint64_t{sections.RawPointers()[i]} + sections.RawSizes()[i];
+            const auto virtualEnd = virtualAddress + std::max(sections.RawSizes()[i], sections.VirtualSizes()[i]);
+            if (rawEnd > _pe.Data().size() || virtualEnd > _optionalHeader.SizeOfImage || virtualAddress < previousEnd)
+            {
+                return PEError::InvalidSection;
+            }
+
+            previousEnd = virtualAddress + sections.VirtualSizes()[i];
+        }
+
+        return PEError::Success;
+    }
+
+    PEError DataDirectories() noexcept
+    {
+        for (int i = 0; i < static_cast<int>(_optionalHeader.NumberOfRvaAndSizes); ++i)
+        {
+            const auto directory = _optionalHeader.DataDirectory[i];
+            if (directory.Size == 0)
+            {
+                continue;
+            }
+
+            // the certificate table is addressed by file offset and never mapped
+            const auto limit = i == IMAGE_DIRECTORY_ENTRY_SECURITY ? _pe.Data().size() : _optionalHeader.SizeOfImage;
+            if (std::uint64_t{directory.VirtualAddress} + directory.Size > limit)
+            {
+                return PEError::InvalidDataDirectory;
+            }
+        }
+
+        for (auto index : {IMAGE_DIRECTORY_ENTRY_IMPORT, IMAGE_DIRECTORY_ENTRY_EXPORT, IMAGE_DIRECTORY_ENTRY_BASERELOC,
+                           IMAGE_DIRECTORY_ENTRY_EXCEPTION, IMAGE_DIRECTORY_ENTRY_TLS})
+        {
+            const auto directory = Directory(index);
+            if (directory.Size != 0 && not _pe.Map<std::uint8_t>(directory.VirtualAddress, directory.Size))
+            {
+                return PEError::InvalidDataDirectory;
+            }
+        }
+
+        return PEError::Success;
+    }
+
+    PEError Imports() noexcept
+    {
+        const auto directory = Directory(IMAGE_DIRECTORY_ENTRY_IMPORT);
+        if (directory.Size == 0)
+        {
+            return PEError::Success;
+        }
+
+        for (auto rva = std::uint64_t{directory.VirtualAddress};; rva += sizeof(IMAGE_IMPORT_DESCRIPTOR))
+        {
+            const auto descriptor = _pe.Map<IMAGE_IMPORT_DESCRIPTOR>(rva);
+            if (descriptor == nullptr)
+            {
+                return PEError::InvalidImportDirectory;
+            }
+
+            if (descriptor->Characteristics == 0)
+            {
+                return PEError::Success;
+            }
+
+            if (not StringInFile(descriptor->Name) || not Thunks(*descriptor))
+            {
+                return PEError::InvalidImportDirectory;
+            }
+
+            ++_importCount;
+        }
+    }
+
+    bool Thunks(const IMAGE_IMPORT_DESCRIPTOR& descriptor) const noexcept
+    {
+        const auto lookupRva = descriptor.OriginalFirstThunk ? descriptor.OriginalFirstThunk : descriptor.FirstThunk;
+        for (std::uint64_t i = 0;; ++i)
+        {
+            const auto thunk = _pe.Map<std::uint64_t>(lookupRva + i * sizeof(std::uint64_t));
+            if (thunk == nullptr || descriptor.FirstThunk + (i + 1) * sizeof(std::uint64_t) > _optionalHeader.SizeOfImage)
+            {
+                return false;
+            }
+
+            if (*thunk == 0)
+            {
+                return true;
+            }
+
+            if (not IMAGE_SNAP_BY_ORDINAL(*thunk) &&
+                (*thunk > 0xffffffff || not StringInFile(static_cast<std::uint32_t>(*thunk) + sizeof(WORD))))
+            {
+                return false;
+            }
+        }
+    }
+
+    PEError Exports() noexcept
+    {
+        const auto directory = Directory(IMAGE_DIRECTORY_ENTRY_EXPORT);
+        if (directory.Size == 0)
+        {
+            return PEError::Success;
+        }
+
+        const auto exportDirectory = _pe.Map<IMAGE_EXPORT_DIRECTORY>(directory.VirtualAddress);
+        if (exportDirectory == nullptr)
+        {
+            return PEError::InvalidExportDirectory;
+        }
+
+        const auto functions = _pe.Map<DWORD>(exportDirectory->AddressOfFunctions, exportDirectory->NumberOfFunctions);
+        const auto names = _pe.Map<DWORD>(exportDirectory->AddressOfNames, exportDirectory->NumberOfNames);
+        const auto ordinals = _pe.Map<WORD>(exportDirectory->AddressOfNameOrdinals, exportDirectory->NumberOfNames);
+        if ((exportDirectory->NumberOfFunctions && functions == nullptr) ||
+            (exportDirectory->NumberOfNames && (names == nullptr || ordinals == nullptr)))
+        {
+            return PEError::InvalidExportDirectory;
+        }
+
+        for (DWORD i = 0; i < exportDirectory->NumberOfNames; ++i)
+        {
+            if (ordinals[i] >= exportDirectory->NumberOfFunctions || not StringInFile(names[i]))
+            {
+                return PEError::InvalidExportDirectory;
+            }
+        }
+
+        for (DWORD i = 0; i < exportDirectory->NumberOfFunctions; ++i)
+        {
+            if (functions[i] >= _optionalHeader.SizeOfImage)
+            {
+                return PEError::InvalidExportDirectory;
+            }
+        }
+
+        return PEError::Success;
+    }
+
+    PEError Relocations() noexcept
+    {
+        const auto directory = Directory(IMAGE_DIRECTORY_ENTRY_BASERELOC);
+        std::uint64_t offset{};
+        while (offset < directory.Size)
+        {
+            const auto header = _pe.Map<IMAGE_BASE_RELOCATION>(directory.VirtualAddress + offset);
+            if (header == nullptr || header->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION) ||
+                header->SizeOfBlock % sizeof(WORD) != 0 || offset + header->SizeOfBlock > directory.Size)
+            {
+                return PEError::InvalidRelocation;
+            }
+
+            const auto entries = reinterpret_cast<const WORD*>(header + 1);
+            const auto count = (header->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(WORD);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const auto type = entries[i] >> 12;
+                const auto target = std::uint64_t{header->VirtualAddress} + (entries[i] & 0xfff);
+                if (type != IMAGE_REL_BASED_ABSOLUTE &&
+                    (type != IMAGE_REL_BASED_DIR64 || target + sizeof(std::uint64_t) > _optionalHeader.SizeOfImage))
+                {
+                    return PEError::InvalidRelocation;
+                }
+            }
+
+            offset += header->SizeOfBlock;
+        }
+
+        return PEError::Success;
+    }
+
+    // The table is handed out unchecked to the symbolizer and the stack walker, which binary-search it and pass its
+    // entries to RtlVirtualUnwind, so it must be sorted and every entry's code and unwind info must lie in the image.
+    PEError Exceptions() noexcept
+    {
+        const auto directory = Directory(IMAGE_DIRECTORY_ENTRY_EXCEPTION);
+        if (directory.Size == 0)
+        {
+            return PEError::Success;
+        }
+
+        const auto count = directory.Size / sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY);
+        const auto functions = _pe.Map<IMAGE_RUNTIME_FUNCTION_ENTRY>(directory.VirtualAddress, count);
+        if (directory.Size % sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY) != 0 || functions == nullptr)
+        {
+            return PEError::InvalidDataDirectory;
+        }
+
+        DWORD previousEnd = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const auto& function = functions[i];
+            if (function.BeginAddress < previousEnd || function.BeginAddress >= function.EndAddress ||
+                function.EndAddress > _optionalHeader.SizeOfImage || not UnwindInfo(function.UnwindInfoAddress))
+            {
+                return PEError::InvalidDataDirectory;
+            }
+
+            previousEnd = function.EndAddress;
+        }
+
+        return PEError::Success;
+    }
+
+    // UNWIND_INFO: a 4-byte header whose third byte counts the 2-byte unwind codes that follow it, padded to an even
+    // count. The flags in the top five bits of the first byte add either a handler RVA or a chained RUNTIME_FUNCTION,
+    // whose own unwind info is checked in turn; `depth` stops a chain that loops.
+    bool UnwindInfo(DWORD rva, int depth = 0) const noexcept
+    {
+        const auto header = _pe.Map<std::uint8_t>(rva, 4);
+        if (header == nullptr || _pe.Map<WORD>(std::uint64_t{rva} + 4, header[2]) == nullptr)
+        {
+            return false;
+        }
+
+        const auto flags = header[0] >> 3;
+        const auto trailer = std::uint64_t{rva} + 4 + (header[2] + 1) / 2 * 2 * sizeof(WORD);
+        if ((flags & UNW_FLAG_CHAININFO) != 0)
+        {
+            const auto chained = _pe.Map<IMAGE_RUNTIME_FUNCTION_ENTRY>(trailer, 1);
+            return depth < MaximumUnwindChain && chained != nullptr &&
+                   chained->BeginAddress < chained->EndAddress &&
+                   chained->EndAddress <= _optionalHeader.SizeOfImage &&
+                   UnwindInfo(chained->UnwindInfoAddress, depth + 1);
+        }
+
+        if ((flags & (UNW_FLAG_EHANDLER | UNW_FLAG_UHANDLER)) != 0)
+        {
+            // the handler's data that follows is language-specific and has no size of its own
+            const auto handler = _pe.Map<DWORD>(trailer, 1);
+            return handler != nullptr && *handler < _optionalHeader.SizeOfImage;
+        }
+
+        return true;
+    }
+};
+
+} // namespace detail
+
+// Bounds-checks the headers, every section, every data directory, the import descriptor chains and the relocation
+// blocks in one pass. A returned token means all of them can be walked without further checks.
+[[nodiscard]] inline std::optional<ValidatedPE> Validate(const PE& pe, PEError& error) noexcept
+{
+    if (not pe.Ok())
+    {
+        error = pe.Error();
+        return {};
+    }
+
+    detail::Validation validation{pe};
+    if (error = validation.Run(); error != PEError::Success)
+    {
+        return {};
+    }
+
+    return ValidatedPE{pe, validation.ImportCount(), validation.BoundImportsValid()};
+}
+
+[[nodiscard]] inline std::optional<ValidatedPE> Validate(const PE& pe) noexcept
+{
+    PEError error{};
+    return Validate(pe, error);
+}
+
+} // namespace Torpedo
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+namespace Torpedo
+{
+
+enum class FileChange
+{
+    // created, written to or renamed into the tree
+    Modified,
+    // deleted or renamed out of the tree
+    Removed,
+    // the change buffer overflowed and events were lost; the whole tree has to be rescanned
+    Overflow,
+};
+
+// Reports changes anywhere under a directory tree through ReadDirectoryChangesW. Nothing is read from the files
+// themselves; callers decide what to re-parse.
+class DirectoryWatcher
+{
+public:
+    DirectoryWatcher(const std::filesystem::path& root) : _root{root}, _buffer(BufferSize / sizeof(DWORD))
+    {
+        // backup semantics is what allows opening a directory handle
+        _directory = CreateFileW(root.c_str(), FILE_LIST_DIRECTORY,
+                                 FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                                 FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    }
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    ~DirectoryWatcher()
+    {
+        if (Ok())
+        {
+            CloseHandle(_directory);
+        }
+    }
+
+    [[nodiscard]] bool Ok() const noexcept { return _directory != INVALID_HANDLE_VALUE; }
+    [[nodiscard]] const std::filesystem::path& Root() const noexcept { return _root; }
+
+    // Blocks until something changes, then calls f(path, change) for every reported entry. A single file usually
+    // shows up several times per write; callers are expected to compare size and write time before re-reading.
+    // Returns false once the watch is broken, e.g. because the root was deleted.
+    template<typename F> bool Wait(F&& f)
+    {
+        DWORD bytes{};
+        if (not ReadDirectoryChangesW(_directory, _buffer.data(), BufferSize, TRUE,
+                                      FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE |
+                                          FILE_NOTIFY_CHANGE_SIZE,
+                                      &bytes, nullptr, nullptr))
+        {
+            if (GetLastError() != ERROR_NOTIFY_ENUM_DIR)
+            {
+                return false;
+            }
+
+            bytes = 0;
+        }
+
+        // zero bytes means the kernel dropped events that did not fit into the buffer
+        if (bytes == 0)
+        {
+            f(_root, FileChange::Overflow);
+            return true;
+        }
+
+        auto entry = reinterpret_cast<const std::uint8_t*>(_buffer.data());
+        while (true)
+        {
+            const auto information = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(entry);
+            const std::wstring_view name{reinterpret_cast<const wchar_t*>(information->FileName),
+                                         information->FileNameLength / sizeof(WCHAR)};
+
+            const auto removed =
+                information->Action == FILE_ACTION_REMOVED || information->Action == FILE_ACTION_RENAMED_OLD_NAME;
+            f(_root / name, removed ? FileChange::Removed : FileChange::Modified);
+
+            if (information->NextEntryOffset == 0)
+            {
+                break;
+            }
+
+            entry += information->NextEntryOffset;
+        }
+
+        return true;
+    }
+
+private:
+    // the largest buffer ReadDirectoryChangesW accepts for network shares
+    static constexpr DWORD BufferSize = 64 * 1024;
+
+    std::filesystem::path _root;
+    HANDLE _directory{INVALID_HANDLE_VALUE};
+    // FILE_NOTIFY_INFORMATION must be DWORD-aligned
+    std::vector<DWORD> _buffer;
+};
+
+} // namespace Torpedo
@@ -1,4 +1,14 @@
 #pragma once
 
+#include "internal/imagecache.hpp"
+#include "internal/imagehash.hpp"
+#include "internal/integrity.hpp"
 #include "internal/loader.hpp"
+#include "internal/ndjson.hpp"
 #include "internal/pe.hpp"
+#include "internal/registry.hpp"
+#include "internal/stackwalk.hpp"
+#include "internal/symbolizer.hpp"
+#include "internal/trace.hpp"
+#include "internal/validator.hpp"
+#include "internal/watcher.hpp"
@@ -0,0 +1,151 @@
+#include "bench.hpp"
+#include "torpedo.hpp"
+
+#include <Psapi.h>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace Torpedo
+{
+
+namespace
+{
+
+// calibration doubles the iteration count until one run takes at least this long
+constexpr auto MinimumRunTime = std::chrono::milliseconds{200};
+
+struct Sample
+{
+    std::int64_t ticks;
+    std::uint64_t cycles;
+    std::uint64_t pageFaults;
+};
+
+struct Result
+{
+    std::uint64_t iterations;
+    double nanoseconds;
+    double cycles;
+    double pageFaults;
+};
+
+Sample sample()
+{
+    LARGE_INTEGER now{};
+    QueryPerformanceCounter(&now);
+
+    ULONG64 cycles{};
+    QueryThreadCycleTime(GetCurrentThread(), &cycles);
+
+    PROCESS_MEMORY_COUNTERS memory{};
+    memory.cb = sizeof(memory);
+    GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory));
+    return {now.QuadPart, cycles, memory.PageFaultCount};
+}
+
+template<typename F> Result measure(std::uint64_t iterations, F&& f)
+{
+    LARGE_INTEGER frequency{};
+    QueryPerformanceFrequency(&frequency);
+
+    // one untimed run warms the caches and faults in the working set
+    f();
+
+    const auto fixed = iterations != 0;
+    for (iterations = fixed ? iterations : 1;; iterations *= 2)
+    {
+        const auto start = sample();
+        for (std::uint64_t i = 0; i < iterations; ++i)
+        {
+            f();
+        }
+        const auto end = sample();
+
+        const auto seconds = static_cast<double>(end.ticks - start.ticks) / static_cast<double>(frequency.QuadPart);
+        if (fixed || seconds >= std::chrono::duration<double>{MinimumRunTime}.count())
+        {
+            const auto count = static_cast<double>(iterations);
+            return {iterations, seconds * 1e9 / count, static_cast<double>(end.cycles - start.cycles) / count,
+                    static_cast<double>(end.pageFaults - start.pageFaults) / count};
+        }
+    }
+}
+
+} // namespace
+
+int Bench::Run(std::FILE* output) const
+{
+    std::ifstream ifs{_path, std::ios_base::in | std::ios_base::binary};
+    const std::string file{std::istreambuf_iterator<char>{ifs}, {}};
+
+    std::istringstream stream{file};
+    const PE pe{stream};
+    const auto validated = Validate(pe);
+    if (not validated)
+    {
+        std::cerr << "failed to validate " << _path.string() << std::endl;
+        return 1;
+    }
+
+    std::string report =
+        std::format("{:<12}{:>12}{:>14}{:>14}{:>12}\n", "benchmark", "iterations", "ns/op", "cycles/op", "faults/op");
+    const auto print = [&report](const char* name, const Result& result) {
+        std::format_to(std::back_inserter(report), "{:<12}{:>12}{:>14.1f}{:>14.1f}{:>12.3f}\n", name,
+                       result.iterations, result.nanoseconds, result.cycles, result.pageFaults);
+    };
+
+    std::pmr::monotonic_buffer_resource arena;
+    print("parse", measure(_iterations, [&] {
+              stream.clear();
+              stream.seekg(0);
+              {
+                  PE parsed{stream, &arena};
+              }
+              arena.release();
+          }));
+
+    volatile bool valid{};
+    print("validate", measure(_iterations, [&] { valid = Validate(pe).has_value(); }));
+
+    // the same copies MapImage makes, into one buffer that is reused so only the copy is timed
+    std::vector<std::uint8_t> image(pe.ImageSize());
+    const auto sectionHeaders = pe.SectionHeaders();
+    const auto headerSize =
+        reinterpret_cast<const std::uint8_t*>(sectionHeaders.data() + sectionHeaders.size()) - pe.Data().data();
+    std::vector<CopyRange> ranges{{0, pe.Data().first(headerSize), 0}};
+    const auto& sections = pe.Sections();
+    for (std::size_t i = 0; i < sections.Size(); ++i)
+    {
+        const auto rawSize = sections.RawSizes()[i];
+        const auto virtualSize = sections.VirtualSizes()[i];
+        ranges.push_back({sections.VirtualAddresses()[i], pe.Data().subspan(sections.RawPointers()[i], rawSize),
+                          virtualSize > rawSize ? virtualSize - rawSize : 0});
+    }
+
+    print("copy", measure(_iterations, [&] {
+              BinaryWriter<UncheckedPolicy> bw{image.data(), image.size()};
+              bw.Gather(ranges);
+          }));
+
+    // alternate the sign so the image ends up where it started after every pair of runs
+    std::uint64_t delta = 0x10000;
+    print("relocate", measure(_iterations, [&] {
+              validated->ForEachRelocation([&image, delta](std::uint32_t rva, auto) {
+                  *reinterpret_cast<std::uint64_t*>(image.data() + rva) += delta;
+              });
+              delta = 0 - delta;
+          }));
+
+    std::fwrite(report.data(), 1, report.size(), output);
+    std::fflush(output);
+    return 0;
+}
+
+} // namespace Torpedo
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+
+namespace Torpedo
+{
+
+// Times the parse, validate, copy and relocation paths on one image. Each benchmark reports wall time next to the
+// hardware counters the OS exposes to an unprivileged process: CPU cycles charged to the thread and page faults taken
+// by the process. Iterations are calibrated per benchmark unless a fixed count is given.
+class Bench
+{
+public:
+    Bench(std::filesystem::path path, std::uint64_t iterations = 0) : _path{std::move(path)}, _iterations{iterations}
+    {
+    }
+
+    // Returns a process exit code.
+    int Run(std::FILE* output) const;
+
+private:
+    std::filesystem::path _path;
+    std::uint64_t _iterations;
+};
+
+} // namespace Torpedo
@@ -0,0 +1,309 @@
+// winsock2 must not be preceded by the legacy winsock.h that the full Windows.h pulls in
+#define WIN32_LEAN_AND_MEAN
+
+#include "daemon.hpp"
+
+#include <WinSock2.h>
+#include <afunix.h>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace Torpedo
+{
+
+namespace
+{
+
+constexpr std::size_t ReceiveSize = 64 * 1024;
+// longer than any request that names a path; a client that goes past it without a newline is dropped
+constexpr std::size_t MaximumLineSize = 64 * 1024;
+
+void appendNumber(std::string& out, std::uint64_t value, int base = 10)
+{
+    char buffer[24];
+    const auto [end, _] = std::to_chars(std::begin(buffer), std::end(buffer), value, base);
+    out.append(buffer, end);
+}
+
+void appendHex(std::string& out, std::uint64_t value)
+{
+    out += "0x";
+    appendNumber(out, value, 16);
+}
+
+void appendMetric(std::string& out, std::string_view name, std::string_view type, std::string_view help,
+                  std::uint64_t value)
+{
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append(name).append(type == "counter" ? "_total " : " ");
+    appendNumber(out, value);
+    out += '\n';
+}
+
+bool sendAll(SOCKET client, std::string_view data)
+{
+    while (not data.empty())
+    {
+        const auto sent = send(client, data.data(), static_cast<int>(std::min<std::size_t>(data.size(), INT_MAX)), 0);
+        if (sent == SOCKET_ERROR)
+        {
+            return false;
+        }
+
+        data.remove_prefix(sent);
+    }
+
+    return true;
+}
+
+struct Connection
+{
+    Daemon* daemon;
+    SOCKET client;
+};
+
+} // namespace
+
+int Daemon::Run(const std::filesystem::path& socketPath)
+{
+    WSADATA wsaData{};
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        std::cerr << "failed to initialize winsock" << std::endl;
+        return 1;
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const auto path = socketPath.string();
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "socket path is too long" << std::endl;
+        return 1;
+    }
+
+    std::memcpy(address.sun_path, path.data(), path.size());
+
+    // a socket file left behind by a previous run would make bind fail
+    std::error_code ec;
+    std::filesystem::remove(socketPath, ec);
+
+    auto listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET ||
+        bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+        listen(listener, SOMAXCONN) == SOCKET_ERROR)
+    {
+        std::cerr << "failed to listen on " << path << ": " << WSAGetLastError() << std::endl;
+        return 1;
+    }
+
+    while (true)
+    {
+        auto client = accept(listener, nullptr, nullptr);
+        if (client == INVALID_SOCKET)
+        {
+            break;
+        }
+
+        ++_connections;
+
+        auto connection = new Connection{this, client};
+        auto serve = [](PTP_CALLBACK_INSTANCE, PVOID context) {
+            auto connection = static_cast<Connection*>(context);
+            connection->daemon->Serve(connection->client);
+            delete connection;
+        };
+
+        if (not TrySubmitThreadpoolCallback(serve, connection, nullptr))
+        {
+            serve(nullptr, connection);
+        }
+    }
+
+    closesocket(listener);
+    WSACleanup();
+    return 1;
+}
+
+void Daemon::Serve(std::uintptr_t client)
+{
+    std::string pending;
+    std::string response;
+    char buffer[ReceiveSize];
+
+    while (true)
+    {
+        const auto received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+        {
+            break;
+        }
+
+        pending.append(buffer, received);
+
+        // answer every complete line in one send, so pipelined requests cost one round trip
+        response.clear();
+        std::size_t begin = 0;
+        for (auto end = pending.find('\n'); end != std::string::npos; end = pending.find('\n', begin))
+        {
+            auto request = std::string_view{pending}.substr(begin, end - begin);
+            if (request.ends_with('\r'))
+            {
+                request.remove_suffix(1);
+            }
+
+            Handle(request, response);
+            response += '\n';
+            begin = end + 1;
+        }
+
+        pending.erase(0, begin);
+        if (pending.size() > MaximumLineSize)
+        {
+            ++_requestErrors;
+            response.append("error line too long\n\n");
+            sendAll(client, response);
+            break;
+        }
+
+        if (not sendAll(client, response))
+        {
+            break;
+        }
+    }
+
+    shutdown(client, SD_BOTH);
+    closesocket(client);
+}
+
+void Daemon::Handle(std::string_view request, std::string& response)
+{
+    const auto start = std::chrono::steady_clock::now();
+    ++_requests;
+
+    const auto space = request.find(' ');
+    const auto command = request.substr(0, space);
+    auto argument = space == std::string_view::npos ? std::string_view{} : request.substr(space + 1);
+
+    const auto fail = [&](std::string_view reason) {
+        ++_requestErrors;
+        response.append("error ").append(reason).append("\n");
+    };
+
+    // the export name is the last word, so paths may contain spaces
+    std::string_view name;
+    if (const auto last = argument.rfind(' '); command == "lookup" && last != std::string_view::npos)
+    {
+        name = argument.substr(last + 1);
+        argument = argument.substr(0, last);
+    }
+
+    if (command == "metrics")
+    {
+        Metrics(response);
+    }
+    else if (command != "info" && command != "sections" && command != "exports" && command != "lookup")
+    {
+        fail("unknown command");
+    }
+    else if (command == "lookup" && name.empty())
+    {
+        fail("usage: lookup <path> <name>");
+    }
+    else if (auto image = _cache.Get(std::filesystem::path{argument}); image == nullptr)
+    {
+        fail("cannot parse image");
+    }
+    else if (const auto& pe = *image->pe; command == "info")
+    {
+        response += "machine ";
+        appendHex(response, pe.NtHeader()->FileHeader.Machine);
+        response += "\nimage_size ";
+        appendNumber(response, pe.ImageSize());
+        response += "\nsections ";
+        appendNumber(response, pe.Sections().Size());
+        response += "\nexports ";
+        appendNumber(response, pe.Exports().Entries().size());
+        response += image->validated ? "\nvalid 1\n" : "\nvalid 0\n";
+    }
+    else if (command == "sections")
+    {
+        for (const auto& sectionHeader : pe.SectionHeaders())
+        {
+            const auto nameData = reinterpret_cast<const char*>(sectionHeader.Name);
+            response.append(nameData, strnlen(nameData, sizeof(sectionHeader.Name))).append(" ");
+            appendHex(response, sectionHeader.VirtualAddress);
+            response += ' ';
+            appendHex(response, sectionHeader.Misc.VirtualSize);
+            response += ' ';
+            appendHex(response, sectionHeader.PointerToRawData);
+            response += ' ';
+            appendHex(response, sectionHeader.SizeOfRawData);
+            response += ' ';
+            appendHex(response, sectionHeader.Characteristics);
+            response += '\n';
+        }
+    }
+    else if (command == "exports")
+    {
+        for (const auto& entry : pe.Exports().Entries())
+        {
+            appendNumber(response, entry.ordinal);
+            response += ' ';
+            appendHex(response, entry.rva);
+            response.append(" ").append(entry.name).append("\n");
+        }
+    }
+    else if (const auto entry = pe.Exports().Find(name); entry == nullptr)
+    {
+        fail("no such export");
+    }
+    else
+    {
+        appendHex(response, entry->rva);
+        response += '\n';
+    }
+
+    _requestNanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Daemon::Metrics(std::string& response) const
+{
+    const auto stats = _cache.Stats();
+
+    appendMetric(response, "torpedo_connections", "counter", "Accepted client connections.", _connections);
+    appendMetric(response, "torpedo_requests", "counter", "Requests handled.", _requests);
+    appendMetric(response, "torpedo_request_errors", "counter", "Requests answered with an error.", _requestErrors);
+    appendMetric(response, "torpedo_cache_hits", "counter", "Lookups served from the image cache.", stats.hits);
+    appendMetric(response, "torpedo_cache_misses", "counter", "Lookups that had to parse the file.", stats.misses);
+    appendMetric(response, "torpedo_cache_evictions", "counter", "Images evicted to stay within budget.",
+                 stats.evictions);
+    appendMetric(response, "torpedo_cache_invalidations", "counter", "Cached images dropped because the file changed.",
+                 stats.invalidations);
+    appendMetric(response, "torpedo_cache_entries", "gauge", "Images currently cached.", stats.entries);
+    appendMetric(response, "torpedo_cache_bytes", "gauge", "File bytes held by cached images.", stats.bytes);
+
+    response.append("# TYPE torpedo_request_seconds summary\n"
+                    "# HELP torpedo_request_seconds Time spent handling requests.\n"
+                    "torpedo_request_seconds_sum ");
+    const auto nanoseconds = _requestNanoseconds.load();
+    appendNumber(response, nanoseconds / 1'000'000'000);
+    response += '.';
+    const auto fraction = std::to_string(nanoseconds % 1'000'000'000);
+    response.append(9 - fraction.size(), '0').append(fraction);
+    response += "\ntorpedo_request_seconds_count ";
+    appendNumber(response, _requests);
+    response += "\n# EOF\n";
+}
+
+} // namespace Torpedo
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "torpedo.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace Torpedo
+{
+
+// Long-running server that keeps parsed images in an ImageCache and answers line-oriented queries over a Unix domain
+// socket. Each request is one line, `<command> [arguments]`; each response is zero or more lines followed by an empty
+// line. Commands:
+//   info <path>             machine, image size, section count, export count and validation result
+//   sections <path>         one line per section: name, virtual address, virtual size, raw pointer, raw size, flags
+//   exports <path>          one line per named export: ordinal, rva, name
+//   lookup <path> <name>    rva of a single export
+//   metrics                 the daemon's counters in OpenMetrics text format
+// Failures are answered with a single `error <reason>` line.
+class Daemon
+{
+public:
+    Daemon(std::size_t cacheBytes) : _cache{cacheBytes} {}
+
+    // Serves connections until the listening socket fails. Returns a process exit code.
+    int Run(const std::filesystem::path& socketPath);
+
+    // Appends the response to `request` (without the terminating empty line) to `response`.
+    void Handle(std::string_view request, std::string& response);
+
+private:
+    ImageCache _cache;
+    std::atomic<std::uint64_t> _connections{};
+    std::atomic<std::uint64_t> _requests{};
+    std::atomic<std::uint64_t> _requestErrors{};
+    std::atomic<std::uint64_t> _requestNanoseconds{};
+
+    void Serve(std::uintptr_t client);
+    void Metrics(std::string& response) const;
+};
+
+} // namespace Torpedo
@@ -1,19 +1,181 @@
+#include "bench.hpp"
+#include "daemon.hpp"
+#include "scanner.hpp"
+#include "watch.hpp"
 #include "torpedo.hpp"
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <io.h>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// Enables tracing and writes the recorded events to a file in the trace viewer's JSON array format. The rings are
+// drained while the command runs, so a long batch does not overflow them, and once more when it finishes.
+class TraceFile
+{
+public:
+    // short enough that a worker's ring cannot fill up between flushes at thousands of files per second
+    static constexpr auto FlushPeriod = std::chrono::milliseconds{50};
+
+    TraceFile(const char* path) : _file{std::fopen(path, "wb")}
+    {
+        if (_file == nullptr)
+        {
+            std::cerr << "failed to open trace file " << path << std::endl;
+            return;
+        }
+
+        std::fputs("[\n", _file);
+        Torpedo::Tracer::Instance().Enable();
+        _flusher = std::jthread{[this](std::stop_token stop) {
+            std::mutex mutex;
+            std::condition_variable_any wakeup;
+            std::unique_lock lock{mutex};
+            while (not wakeup.wait_for(lock, stop, FlushPeriod, [&stop] { return stop.stop_requested(); }))
+            {
+                Flush();
+            }
+        }};
+    }
+
+    TraceFile(const TraceFile&) = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+
+    ~TraceFile()
+    {
+        if (_file == nullptr)
+        {
+            return;
+        }
+
+        _flusher.request_stop();
+        _flusher.join();
+        Flush();
+        std::fclose(_file);
+    }
+
+private:
+    std::FILE* _file;
+    std::string _events;
+    std::jthread _flusher;
+
+    // only the flusher thread calls this until it has been joined
+    void Flush()
+    {
+        _events.clear();
+        Torpedo::Tracer::Instance().Flush(std::back_inserter(_events));
+        std::fwrite(_events.data(), 1, _events.size(), _file);
+    }
+};
+
+} // namespace
 
 int main(int argc, char** argv)
 {
+    // --trace <file> may precede any command
+    std::optional<TraceFile> trace;
+    if (argc > 2 && std::string_view{argv[1]} == "--trace")
+    {
+        trace.emplace(argv[2]);
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " <dll path>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--trace <file>] <dll path | ->" << std::endl;
+        std::cerr << "       " << argv[0] << " --daemon <socket path> [cache size in MiB]" << std::endl;
+        std::cerr << "       " << argv[0] << " --ndjson [paths... | < path list]" << std::endl;
+        std::cerr << "       " << argv[0] << " --watch <directory>" << std::endl;
+        std::cerr << "       " << argv[0] << " --bench <dll path> [iterations]" << std::endl;
         return 1;
     }
 
-    Torpedo::PE ntdll{argv[1]};
+    if (std::string_view{argv[1]} == "--ndjson")
+    {
+        std::vector<std::filesystem::path> paths{argv + 2, argv + argc};
+        if (paths.empty())
+        {
+            for (std::string line; std::getline(std::cin, line);)
+            {
+                paths.emplace_back(line);
+            }
+        }
+
+        // text mode would turn every record separator into CRLF
+        _setmode(_fileno(stdout), _O_BINARY);
+        Torpedo::Scanner{}.Scan(paths, stdout);
+        return 0;
+    }
+
+    if (std::string_view{argv[1]} == "--watch")
+    {
+        if (argc < 3)
+        {
+            std::cerr << "missing directory" << std::endl;
+            return 1;
+        }
+
+        _setmode(_fileno(stdout), _O_BINARY);
+        return Torpedo::Watch{argv[2], stdout}.Run();
+    }
+
+    if (std::string_view{argv[1]} == "--bench")
+    {
+        if (argc < 3)
+        {
+            std::cerr << "missing dll path" << std::endl;
+            return 1;
+        }
+
+        const std::uint64_t iterations = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 0;
+        return Torpedo::Bench{argv[2], iterations}.Run(stdout);
+    }
+
+    if (std::string_view{argv[1]} == "--daemon")
+    {
+        if (argc < 3)
+        {
+            std::cerr << "missing socket path" << std::endl;
+            return 1;
+        }
+
+        const std::size_t cacheMiB = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 256;
+        Torpedo::Daemon daemon{cacheMiB << 20};
+        return daemon.Run(argv[2]);
+    }
+
+    std::optional<Torpedo::PE> ntdll;
+    if (std::string_view{argv[1]} == "-")
+    {
+        // stdin is opened in text mode by default, which would mangle the image
+        _setmode(_fileno(stdin), _O_BINARY);
+        ntdll.emplace(std::cin);
+    }
+    else
+    {
+        ntdll.emplace(argv[1]);
+    }
+
     Torpedo::ModuleLoader loader;
 
-    auto module = loader.Load(ntdll);
+    auto module = loader.Load(*ntdll);
     if (not module)
     {
         std::cerr << "failed to load module" << std::endl;
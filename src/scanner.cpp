@@ -0,0 +1,87 @@
+#include "scanner.hpp"
+#include "torpedo.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+namespace Torpedo
+{
+
+namespace
+{
+
+// enough in-flight files to keep every worker busy while the writer drains a slow one
+constexpr std::size_t SlotsPerWorker = 4;
+
+struct Slot
+{
+    std::string buffer;
+    std::atomic<std::size_t> ready{static_cast<std::size_t>(-1)};
+};
+
+} // namespace
+
+void Scanner::Scan(std::span<const std::filesystem::path> paths, std::FILE* output) const
+{
+    const auto window = static_cast<std::size_t>(_workers) * SlotsPerWorker;
+    std::vector<Slot> slots(window);
+    std::atomic<std::size_t> next{};
+    std::atomic<std::size_t> written{};
+
+    const auto work = [&] {
+        std::pmr::monotonic_buffer_resource arena;
+        for (auto i = next++; i < paths.size(); i = next++)
+        {
+            // a slot is reused only after the writer has flushed the file that held it
+            for (auto flushed = written.load(); i >= flushed + window; flushed = written.load())
+            {
+                written.wait(flushed);
+            }
+
+            auto& slot = slots[i % window];
+            slot.buffer.clear();
+            {
+                const auto source = paths[i].string();
+                TraceScope trace{"scanner", "file", source};
+                PE pe{paths[i], &arena};
+                FormatNdjson(std::back_inserter(slot.buffer), pe, source);
+            }
+            arena.release();
+
+            slot.ready.store(i);
+            slot.ready.notify_one();
+        }
+    };
+
+    std::vector<std::jthread> workers;
+    workers.reserve(_workers);
+    for (unsigned i = 0; i < _workers; ++i)
+    {
+        workers.emplace_back(work);
+    }
+
+    for (std::size_t i = 0; i < paths.size(); ++i)
+    {
+        auto& slot = slots[i % window];
+        for (auto ready = slot.ready.load(); ready != i; ready = slot.ready.load())
+        {
+            slot.ready.wait(ready);
+        }
+
+        {
+            TraceScope trace{"scanner", "write"};
+            std::fwrite(slot.buffer.data(), 1, slot.buffer.size(), output);
+        }
+
+        written.store(i + 1);
+        written.notify_all();
+    }
+
+    std::fflush(output);
+}
+
+} // namespace Torpedo
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdio>
+#include <filesystem>
+#include <span>
+#include <thread>
+
+namespace Torpedo
+{
+
+// Parses files on worker threads and writes their NDJSON records (see FormatNdjson) in the order the paths were given,
+// whatever order the workers finish in. Each worker formats into a reusable slot buffer, so output text is not
+// reallocated per file. Parsing goes into a per-worker arena that is released after each file, which frees a file's
+// allocations in one step but hands its chunks back to the heap, so every file still allocates from it.
+class Scanner
+{
+public:
+    Scanner(unsigned workers = std::thread::hardware_concurrency()) : _workers{workers ? workers : 1} {}
+
+    void Scan(std::span<const std::filesystem::path> paths, std::FILE* output) const;
+
+private:
+    unsigned _workers;
+};
+
+} // namespace Torpedo
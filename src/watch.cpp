@@ -0,0 +1,175 @@
+#include "watch.hpp"
+
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <system_error>
+
+namespace Torpedo
+{
+
+namespace
+{
+
+bool isWithin(const std::filesystem::path& path, const std::filesystem::path& directory)
+{
+    return std::mismatch(directory.begin(), directory.end(), path.begin(), path.end()).first == directory.end();
+}
+
+} // namespace
+
+int Watch::Run()
+{
+    if (not _watcher.Ok())
+    {
+        std::cerr << "failed to watch " << _watcher.Root().string() << std::endl;
+        return 1;
+    }
+
+    Rescan();
+    Flush();
+
+    while (_watcher.Wait([this](const std::filesystem::path& path, FileChange change) {
+        switch (change)
+        {
+        case FileChange::Modified:
+            Touch(path);
+            break;
+        case FileChange::Removed:
+            Remove(path);
+            break;
+        case FileChange::Overflow:
+            Rescan();
+            break;
+        }
+    }))
+    {
+        Flush();
+    }
+
+    std::cerr << "watch on " << _watcher.Root().string() << " stopped" << std::endl;
+    return 1;
+}
+
+// Walks the whole tree, but still only stats files; anything whose size and write time match the index is skipped.
+void Watch::Rescan()
+{
+    std::vector<std::filesystem::path> missing;
+    for (const auto& [path, _] : _index)
+    {
+        std::error_code ec;
+        if (not std::filesystem::is_regular_file(path, ec))
+        {
+            missing.push_back(path);
+        }
+    }
+
+    for (const auto& path : missing)
+    {
+        Remove(path);
+    }
+
+    std::error_code ec;
+    for (std::filesystem::recursive_directory_iterator it{_watcher.Root(), ec}, end; not ec && it != end;
+         it.increment(ec))
+    {
+        if (it->is_regular_file(ec))
+        {
+            Touch(it->path());
+        }
+    }
+}
+
+void Watch::Touch(const std::filesystem::path& path)
+{
+    std::error_code ec;
+    const auto status = std::filesystem::status(path, ec);
+    if (ec || status.type() == std::filesystem::file_type::not_found)
+    {
+        Remove(path);
+        return;
+    }
+
+    // a directory moved into the tree only produces an event for the directory itself
+    if (status.type() == std::filesystem::file_type::directory)
+    {
+        for (std::filesystem::recursive_directory_iterator it{path, ec}, end; not ec && it != end; it.increment(ec))
+        {
+            if (it->is_regular_file(ec))
+            {
+                Touch(it->path());
+            }
+        }
+
+        return;
+    }
+
+    if (status.type() != std::filesystem::file_type::regular)
+    {
+        return;
+    }
+
+    const FileState state{std::filesystem::last_write_time(path, ec), std::filesystem::file_size(path, ec)};
+    if (ec)
+    {
+        return;
+    }
+
+    auto [entry, inserted] = _index.try_emplace(path, state);
+    if (not inserted)
+    {
+        if (entry->second.lastWriteTime == state.lastWriteTime && entry->second.size == state.size)
+        {
+            return;
+        }
+
+        entry->second = state;
+    }
+
+    if (std::ranges::find(_changed, path) == _changed.end())
+    {
+        _changed.push_back(path);
+    }
+}
+
+void Watch::Remove(const std::filesystem::path& path)
+{
+    // removing a directory reports only the directory, so drop everything tracked below it too
+    auto entry = _index.lower_bound(path);
+    while (entry != _index.end() && isWithin(entry->first, path))
+    {
+        std::erase(_changed, entry->first);
+        _removed.push_back(entry->first);
+        entry = _index.erase(entry);
+    }
+}
+
+void Watch::Flush()
+{
+    if (_changed.empty() && _removed.empty())
+    {
+        return;
+    }
+
+    std::string records;
+    for (const auto& path : _removed)
+    {
+        std::format_to(std::back_inserter(records), "{{\"type\":\"removed\",\"source\":{}}}\n",
+                       detail::JsonString{path.string()});
+    }
+
+    std::fwrite(records.data(), 1, records.size(), _output);
+    _scanner.Scan(_changed, _output);
+
+    records.clear();
+    std::format_to(std::back_inserter(records), "{{\"type\":\"index\",\"files\":{}}}\n", _index.size());
+    std::fwrite(records.data(), 1, records.size(), _output);
+    std::fflush(_output);
+
+    _changed.clear();
+    _removed.clear();
+}
+
+} // namespace Torpedo
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "scanner.hpp"
+#include "torpedo.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <vector>
+
+namespace Torpedo
+{
+
+// Keeps NDJSON output current for every file under a directory tree. The tree is scanned once; after that only files
+// whose size or write time changed are parsed again, and deleted files are reported with a "removed" record. Each
+// batch of changes ends with an "index" record carrying the number of tracked files.
+class Watch
+{
+public:
+    Watch(const std::filesystem::path& root, std::FILE* output) : _watcher{root}, _output{output} {}
+
+    // Runs until the watch breaks. Returns a process exit code.
+    int Run();
+
+private:
+    struct FileState
+    {
+        std::filesystem::file_time_type lastWriteTime;
+        std::uintmax_t size;
+    };
+
+    DirectoryWatcher _watcher;
+    std::FILE* _output;
+    Scanner _scanner;
+    std::map<std::filesystem::path, FileState> _index;
+    std::vector<std::filesystem::path> _changed;
+    std::vector<std::filesystem::path> _removed;
+
+    void Rescan();
+    void Touch(const std::filesystem::path& path);
+    void Remove(const std::filesystem::path& path);
+    void Flush();
+};
+
+} // namespace Torpedo